@@ -0,0 +1,323 @@
+#if !defined(_CACHE_BTREE_H_)
+#define _CACHE_BTREE_H_
+
+#include "CacheEntry.h"
+
+#include <algorithm>
+#include <atomic>
+
+// in-memory B+-tree of cache entries, ordered like CacheSkipList
+// (CacheEntryComparator: by to, then by from descending).
+// optimistic lock coupling: readers take no locks, they check the version
+// of each node after reading it and restart if a writer was there; writers
+// lock the nodes they change and split full nodes on the way down.
+// entries are never removed (like the skiplist), so nodes are never freed
+// and a reader never touches freed memory
+class CacheBTree {
+public:
+  CacheBTree() : entry_cnt(0) { root.store(new Leaf); }
+
+  // false if an entry of the same range is in the tree
+  bool insert(CacheEntry *e);
+
+  // the first entry not less than (greater than) |e|, nullptr if none
+  const CacheEntry *lower_bound(const CacheEntry &e) const {
+    return seek(e, false);
+  }
+  const CacheEntry *upper_bound(const CacheEntry &e) const {
+    return seek(e, true);
+  }
+
+  uint64_t size() const { return entry_cnt.load(); }
+
+private:
+  // keys per node; separate arrays so that a binary search walks
+  // through |to| only (ties on |to| are rare)
+  static const int kCnt = 32;
+
+  struct Node {
+    std::atomic<uint64_t> version; // 0b10: locked
+    bool is_leaf;
+    int16_t cnt;
+    Key to[kCnt];
+    Key from[kCnt];
+
+    Node(bool is_leaf) : version(0), is_leaf(is_leaf), cnt(0) {}
+
+    uint64_t read_lock(bool &restart) const {
+      uint64_t v = version.load(std::memory_order_acquire);
+      if (v & 0b10) {
+        asm volatile("pause");
+        restart = true;
+      }
+      return v;
+    }
+    // nothing read since read_lock() was changed
+    void check(uint64_t v, bool &restart) const {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (version.load(std::memory_order_relaxed) != v) {
+        restart = true;
+      }
+    }
+    void upgrade(uint64_t &v, bool &restart) {
+      if (version.compare_exchange_strong(v, v + 0b10,
+                                          std::memory_order_acquire)) {
+        v += 0b10;
+      } else {
+        restart = true;
+      }
+    }
+    void write_unlock() { version.fetch_add(0b10, std::memory_order_release); }
+
+    bool is_full() const { return cnt == kCnt; }
+
+    // first key >= (to, from), or > if |strict|
+    int rank(const Key &k_to, const Key &k_from, bool strict) const {
+      int lo = 0;
+      int hi = std::min<int>(cnt, kCnt); // cnt may be torn
+      while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        bool less = to[mid] < k_to ||
+                    (to[mid] == k_to &&
+                     (strict ? from[mid] >= k_from : from[mid] > k_from));
+        if (less) {
+          lo = mid + 1;
+        } else {
+          hi = mid;
+        }
+      }
+      return lo;
+    }
+  };
+
+  // children[i] holds the keys in (to/from[i - 1], to/from[i]]
+  struct Inner : Node {
+    Node *children[kCnt + 1];
+
+    Inner() : Node(false) {}
+
+    // |right| was split from the child holding (k_to, k_from)
+    void insert(const Key &k_to, const Key &k_from, Node *right) {
+      int pos = rank(k_to, k_from, false);
+      for (int i = cnt; i > pos; --i) {
+        to[i] = to[i - 1];
+        from[i] = from[i - 1];
+        children[i + 1] = children[i];
+      }
+      to[pos] = k_to;
+      from[pos] = k_from;
+      children[pos + 1] = right;
+      cnt++;
+    }
+
+    Inner *split(Key &sep_to, Key &sep_from) {
+      auto right = new Inner;
+      int m = cnt / 2;
+      sep_to = to[m];
+      sep_from = from[m];
+      right->cnt = cnt - m - 1;
+      for (int i = 0; i < right->cnt; ++i) {
+        right->to[i] = to[m + 1 + i];
+        right->from[i] = from[m + 1 + i];
+        right->children[i] = children[m + 1 + i];
+      }
+      right->children[right->cnt] = children[cnt];
+      cnt = m;
+      return right;
+    }
+  };
+
+  struct Leaf : Node {
+    CacheEntry *entries[kCnt];
+
+    Leaf() : Node(true) {}
+
+    bool insert(CacheEntry *e) {
+      int pos = rank(e->to, e->from, false);
+      if (pos < cnt && to[pos] == e->to && from[pos] == e->from) {
+        return false;
+      }
+      for (int i = cnt; i > pos; --i) {
+        to[i] = to[i - 1];
+        from[i] = from[i - 1];
+        entries[i] = entries[i - 1];
+      }
+      to[pos] = e->to;
+      from[pos] = e->from;
+      entries[pos] = e;
+      cnt++;
+      return true;
+    }
+
+    // the left half stays, |sep| is its largest key
+    Leaf *split(Key &sep_to, Key &sep_from) {
+      auto right = new Leaf;
+      int m = cnt / 2;
+      right->cnt = cnt - m;
+      for (int i = 0; i < right->cnt; ++i) {
+        right->to[i] = to[m + i];
+        right->from[i] = from[m + i];
+        right->entries[i] = entries[m + i];
+      }
+      cnt = m;
+      sep_to = to[m - 1];
+      sep_from = from[m - 1];
+      return right;
+    }
+  };
+
+  std::atomic<Node *> root;
+  std::atomic<uint64_t> entry_cnt;
+
+  const CacheEntry *seek(const CacheEntry &e, bool strict) const;
+  // |parent| and |node| are locked
+  void split(Inner *parent, Node *node);
+};
+
+inline const CacheEntry *CacheBTree::seek(const CacheEntry &e,
+                                          bool strict) const {
+restart:
+  bool restart = false;
+  Node *node = root.load(std::memory_order_acquire);
+  uint64_t v = node->read_lock(restart);
+  if (restart || node != root.load(std::memory_order_acquire)) {
+    goto restart;
+  }
+
+  while (!node->is_leaf) {
+    auto inner = (Inner *)node;
+    int pos = inner->rank(e.to, e.from, strict);
+    Node *child = inner->children[std::min<int>(pos, kCnt)];
+    inner->check(v, restart);
+    if (restart) {
+      goto restart;
+    }
+
+    uint64_t child_v = child->read_lock(restart);
+    inner->check(v, restart); // |child| was not split in between
+    if (restart) {
+      goto restart;
+    }
+    node = child;
+    v = child_v;
+  }
+
+  auto leaf = (Leaf *)node;
+  int pos = leaf->rank(e.to, e.from, strict);
+  CacheEntry *res = pos < std::min<int>(leaf->cnt, kCnt) ? leaf->entries[pos]
+                                                          : nullptr;
+  leaf->check(v, restart);
+  if (restart) {
+    goto restart;
+  }
+  return res;
+}
+
+inline void CacheBTree::split(Inner *parent, Node *node) {
+  Key sep_to, sep_from;
+  Node *right = node->is_leaf ? (Node *)((Leaf *)node)->split(sep_to, sep_from)
+                              : ((Inner *)node)->split(sep_to, sep_from);
+
+  if (parent) {
+    parent->insert(sep_to, sep_from, right);
+  } else { // new root
+    auto new_root = new Inner;
+    new_root->cnt = 1;
+    new_root->to[0] = sep_to;
+    new_root->from[0] = sep_from;
+    new_root->children[0] = node;
+    new_root->children[1] = right;
+    root.store(new_root, std::memory_order_release);
+  }
+}
+
+inline bool CacheBTree::insert(CacheEntry *e) {
+restart:
+  bool restart = false;
+  Node *node = root.load(std::memory_order_acquire);
+  uint64_t v = node->read_lock(restart);
+  if (restart || node != root.load(std::memory_order_acquire)) {
+    goto restart;
+  }
+
+  Inner *parent = nullptr;
+  uint64_t parent_v = 0;
+  while (true) {
+    if (node->is_full()) { // split on the way down, the parent has room
+      if (parent) {
+        parent->upgrade(parent_v, restart);
+        if (restart) {
+          goto restart;
+        }
+      }
+      node->upgrade(v, restart);
+      if (restart) {
+        if (parent) {
+          parent->write_unlock();
+        }
+        goto restart;
+      }
+      if (!parent && node != root.load(std::memory_order_acquire)) {
+        node->write_unlock(); // another thread grew the tree
+        goto restart;
+      }
+
+      split(parent, node);
+
+      node->write_unlock();
+      if (parent) {
+        parent->write_unlock();
+      }
+      goto restart;
+    }
+
+    if (node->is_leaf) {
+      break;
+    }
+
+    if (parent) {
+      parent->check(parent_v, restart);
+      if (restart) {
+        goto restart;
+      }
+    }
+
+    auto inner = (Inner *)node;
+    Node *child = inner->children[inner->rank(e->to, e->from, false)];
+    inner->check(v, restart);
+    if (restart) {
+      goto restart;
+    }
+
+    parent = inner;
+    parent_v = v;
+    node = child;
+    v = node->read_lock(restart);
+    if (restart) {
+      goto restart;
+    }
+  }
+
+  auto leaf = (Leaf *)node;
+  leaf->upgrade(v, restart);
+  if (restart) {
+    goto restart;
+  }
+  if (parent) {
+    parent->check(parent_v, restart);
+    if (restart) {
+      leaf->write_unlock();
+      goto restart;
+    }
+  }
+
+  bool res = leaf->insert(e);
+  leaf->write_unlock();
+
+  if (res) {
+    entry_cnt.fetch_add(1);
+  }
+  return res;
+}
+
+#endif // _CACHE_BTREE_H_
@@ -8,10 +8,12 @@ struct CacheEntry {
   Key from;
   Key to; // [from, to]
   mutable InternalPage *ptr;
+  mutable uint64_t slot; // in IndexCache, valid while the slot holds it
 }
  __attribute__((packed));
 
-static_assert(sizeof(CacheEntry) == 2 * sizeof(Key) + sizeof(uint64_t), "XXX");
+static_assert(sizeof(CacheEntry) == 2 * sizeof(Key) + 2 * sizeof(uint64_t),
+              "XXX");
 
 inline std::ostream &operator<<(std::ostream &os, const CacheEntry &obj) {
   os << "[" << (int)obj.from << ", " << obj.to + 1 << ")";
@@ -22,7 +22,9 @@
 // #define CONFIG_ENABLE_EMBEDDING_LOCK
 // #define CONFIG_ENABLE_CRC
 
-#define LATENCY_WINDOWS 1000000
+// leaf pages carry a fingerprint array beside the records,
+// searched with SIMD (3 fewer records per leaf)
+// #define CONFIG_ENABLE_LEAF_FP
 
 #define STRUCT_OFFSET(type, field)                                             \
   (char *)&((type *)(0))->field - (char *)((type *)(0))
@@ -45,7 +47,7 @@
 // }
 
 // { dir thread
-#define NR_DIRECTORY 1
+#define MAX_DIRECTORY 4 // per memory node, DSMConfig::dirNR are used
 
 #define DIR_MESSAGE_NR 128
 // }
@@ -78,6 +80,7 @@ constexpr uint16_t kCacheLineSize = 64;
 
 // for remote allocate
 constexpr uint64_t kChunkSize = 32 * MB;
+constexpr int kChunksPerMalloc = 2; // at most, by one rpc
 
 // for store root pointer
 constexpr uint64_t kRootPointerStoreOffest = kChunkSize / 2;
@@ -97,10 +100,13 @@ constexpr uint64_t kMaxLevelOfTree = 7;
 
 constexpr uint16_t kMaxCoro = 8;
 constexpr int64_t kPerCoroRdmaBuf = 128 * 1024;
+// per thread, behind the buffers of coroutines (for bulk load)
+constexpr int64_t kBulkRdmaBuf = 8 * MB;
 
 constexpr uint8_t kMaxHandOverTime = 8;
 
 constexpr int kIndexCacheSize = 1000; // MB
+constexpr int kLeafCacheSize = 64;     // MB, if enable_leaf_cache
 } // namespace define
 
 static inline unsigned long long asm_rdtsc(void) {
@@ -10,15 +10,51 @@ public:
   CacheConfig(uint32_t cacheSize = 1) : cacheSize(cacheSize) {}
 };
 
+// RDMA: one process per server, connected by RNICs and memcached
+// EMULATED: one process hosts all |machineNR| memory nodes (single host)
+enum class TransportType : uint8_t {
+  RDMA,
+  EMULATED,
+};
+
+// the memory node of a page from DSM::alloc
+// ROUND_ROBIN: a thread fills a chunk on one node, then moves on to the
+//              next node; a thread holds about two chunks ahead of use
+// INTERLEAVE: every node in turn per page, spreads siblings (and their lock
+//             slots) over the NICs, but a thread carves one chunk on every
+//             node, i.e. machineNR chunks per thread are held ahead of use
+// LEAST_USED: freed pages first, then a chunk on the node with the lowest
+//             share of chunks in use (as last told by its directories),
+//             picked again when the chunk runs out
+// NEAR_PARENT: the node of the hint (the parent page), so a page, its
+//              siblings and their locks can be reached through one QP.
+//              on its own this puts the whole tree on one node: without a
+//              hint, or when the hint's node is well above the mean share
+//              of chunks in use, pages go as with LEAST_USED
+enum class Placement : uint8_t {
+  ROUND_ROBIN,
+  INTERLEAVE,
+  LEAST_USED,
+  NEAR_PARENT,
+};
+
 class DSMConfig {
 public:
   CacheConfig cacheConfig;
   uint32_t machineNR;
   uint64_t dsmSize; // G
+  TransportType transport;
+  Placement placement;
+  // directory threads per memory node (<= MAX_DIRECTORY), each serves rpcs
+  // for an equal slice of the node's memory; the same on every node
+  uint32_t dirNR;
 
   DSMConfig(const CacheConfig &cacheConfig = CacheConfig(),
-            uint32_t machineNR = 2, uint64_t dsmSize = 8)
-      : cacheConfig(cacheConfig), machineNR(machineNR), dsmSize(dsmSize) {}
+            uint32_t machineNR = 2, uint64_t dsmSize = 8,
+            TransportType transport = TransportType::RDMA,
+            Placement placement = Placement::ROUND_ROBIN, uint32_t dirNR = 1)
+      : cacheConfig(cacheConfig), machineNR(machineNR), dsmSize(dsmSize),
+        transport(transport), placement(placement), dirNR(dirNR) {}
 };
 
 #endif /* __CONFIG_H__ */
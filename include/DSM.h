@@ -2,17 +2,26 @@
 #define __DSM_H__
 
 #include <atomic>
+#include <queue>
 
 #include "Cache.h"
 #include "Config.h"
 #include "Connection.h"
 #include "DSMKeeper.h"
 #include "GlobalAddress.h"
+#include "Histogram.h"
 #include "LocalAllocator.h"
+#include "Metrics.h"
 #include "RdmaBuffer.h"
+#include "Transport.h"
 
 class DSMKeeper;
 class Directory;
+class EmulatedFabric;
+
+// coroutines which yield with no RDMA op pending, the master resumes
+// them (Tree::coro_master)
+extern thread_local std::queue<uint16_t> hot_wait_queue;
 
 class DSM {
 
@@ -29,6 +38,7 @@ public:
   uint16_t getMyThreadID() { return thread_id; }
   uint16_t getClusterSize() { return conf.machineNR; }
   uint64_t getThreadTag() { return thread_tag; }
+  bool is_emulated() { return conf.transport == TransportType::EMULATED; }
 
   // RDMA operations
   // buffer is registered memory
@@ -46,6 +56,9 @@ public:
                    CoroContext *ctx = nullptr);
   void write_batch_sync(RdmaOpRegion *rs, int k, CoroContext *ctx = nullptr);
 
+  // READs which may go to different nodes (|rs| is reordered by node)
+  void read_batches_sync(RdmaOpRegion *rs, int k, CoroContext *ctx = nullptr);
+
   void write_faa(RdmaOpRegion &write_ror, RdmaOpRegion &faa_ror,
                  uint64_t add_val, bool signal = true,
                  CoroContext *ctx = nullptr);
@@ -114,8 +127,19 @@ public:
   uint64_t poll_rdma_cq(int count = 1);
   bool poll_rdma_cq_once(uint64_t &wr_id);
 
+  // verbs posted by app thread |thread_id|, or by all of them (-1);
+  // can be taken while the threads keep posting
+  DSMMetrics get_metrics(int thread_id = -1);
+  // send-to-reply time of the MALLOC rpcs an alloc() had to wait for
+  LatencyHistogram get_malloc_latency(int thread_id = -1);
+  // call when app threads are quiescent
+  void clear_metrics();
+
   uint64_t sum(uint64_t value) {
     static uint64_t count = 0;
+    if (keeper == nullptr) { // emulated, single compute node
+      return value;
+    }
     return keeper->sum(std::string("sum-") + std::to_string(count++), value);
   }
 
@@ -142,7 +166,26 @@ private:
   ~DSM();
 
   void initRDMAConnection();
+  void initEmulatedConnection();
   void fill_keys_dest(RdmaOpRegion &ror, GlobalAddress addr, bool is_chip);
+  void return_empty_chunks();
+
+  // chunk prefetch: at most one MALLOC in flight, its reply fills the
+  // reserve of local_allocator
+  void call_malloc(uint16_t node_id, int chunk_cnt = 1);
+  void take_chunks(const RawMessage *reply);
+  void finish_malloc(CoroContext *cxt = nullptr);
+  void send_rpc(const RawMessage &m, uint16_t node_id, uint16_t dir_id);
+
+  // placement (conf.placement) of a page of |size|. chunked: the page goes
+  // to chunk_node(), whose chunk is used up before another node is picked
+  uint16_t place(size_t size, GlobalAddress hint, bool &chunked);
+  uint16_t chunk_node();
+  uint16_t after_node();
+  void next_chunk_node();
+  uint16_t node_after(uint16_t node);
+  uint16_t least_used_node();
+  bool crowded(uint16_t node_id) const;
 
   DSMConfig conf;
   std::atomic_int appID;
@@ -150,78 +193,344 @@ private:
 
   static thread_local int thread_id;
   static thread_local ThreadConnection *iCon;
+  static thread_local Transport *transport;
   static thread_local char *rdma_buffer;
   static thread_local LocalAllocator local_allocator;
+
+  struct MallocState {
+    bool in_flight;
+    uint16_t node_id, dir_id; // of the last MALLOC
+    uint64_t sent_ns;
+    uint64_t next_dir[MAX_MACHINE]; // round-robin among equals
+    uint64_t next_node; // round-robin among nodes
+    // chunk-sized placement: pages go to chunk_node until its chunk runs
+    // out, then to after_node, picked when the chunk is about to run out
+    uint16_t chunk_node, after_node;
+    bool has_chunk_node, has_after_node;
+    // chunks of each directory, as last replied
+    uint64_t used[MAX_MACHINE][MAX_DIRECTORY];
+    uint64_t total[MAX_MACHINE][MAX_DIRECTORY];
+
+    // an unknown directory counts as empty
+    double usage(uint16_t node_id, uint16_t dir_id) const {
+      return total[node_id][dir_id] == 0
+                 ? 0
+                 : used[node_id][dir_id] * 1.0 / total[node_id][dir_id];
+    }
+    double node_usage(uint16_t node_id, uint32_t dir_nr) const {
+      double sum = 0;
+      for (uint32_t k = 0; k < dir_nr; ++k) {
+        sum += usage(node_id, k);
+      }
+      return sum / dir_nr;
+    }
+  };
+  static thread_local MallocState malloc_state;
   static thread_local RdmaBuffer rbuf[define::kMaxCoro];
   static thread_local uint64_t thread_tag;
 
+  static DSMMetrics metrics[MAX_APP_THREAD];
+  static LatencyHistogram malloc_latency[MAX_APP_THREAD];
+
   uint64_t baseAddr;
   uint32_t myNodeID;
 
   RemoteConnection *remoteInfo;
   ThreadConnection *thCon[MAX_APP_THREAD];
-  DirectoryConnection *dirCon[NR_DIRECTORY];
+  Transport *thTrans[MAX_APP_THREAD];
+  DirectoryConnection *dirCon[MAX_DIRECTORY];
   DSMKeeper *keeper;
 
-  Directory *dirAgent[NR_DIRECTORY];
+  Directory *dirAgent[MAX_DIRECTORY];
+  EmulatedFabric *fabric; // only for TransportType::EMULATED
 
 public:
   bool is_register() { return thread_id != -1; }
-  void barrier(const std::string &ss) { keeper->barrier(ss); }
+  void barrier(const std::string &ss) {
+    if (keeper) {
+      keeper->barrier(ss);
+    }
+  }
 
   char *get_rdma_buffer() { return rdma_buffer; }
   RdmaBuffer &get_rbuf(int coro_id) { return rbuf[coro_id]; }
+  char *get_bulk_buffer() {
+    return rdma_buffer + define::kMaxCoro * define::kPerCoroRdmaBuf;
+  }
 
-  GlobalAddress alloc(size_t size);
-  void free(GlobalAddress addr);
+  // a page on the node chosen by conf.placement, |hint| is the parent.
+  // a coroutine yields while it waits for a chunk
+  GlobalAddress alloc(size_t size, GlobalAddress hint = GlobalAddress::Null(),
+                      CoroContext *cxt = nullptr);
+  // |addr| of |size| bytes is reused a while later, see LocalAllocator
+  void free(GlobalAddress addr, size_t size);
 
+  // give a whole chunk back to its memory node
+  void free_chunk(GlobalAddress addr);
+  // chunks used by a memory node and all of its chunks
+  void chunk_usage(uint16_t node_id, uint64_t *used, uint64_t *total);
+
+  // replies come in arrival order, so a chunk prefetch in flight is
+  // finished first
   void rpc_call_dir(const RawMessage &m, uint16_t node_id,
                     uint16_t dir_id = 0) {
+    finish_malloc();
+    send_rpc(m, node_id, dir_id);
+  }
+
+  RawMessage *rpc_wait() { return transport->rpc_wait(); }
+};
+
+inline void DSM::send_rpc(const RawMessage &m, uint16_t node_id,
+                          uint16_t dir_id) {
+  RawMessage buffer;
+
+  memcpy(&buffer, &m, sizeof(RawMessage));
+  buffer.node_id = myNodeID;
+  buffer.app_id = thread_id;
 
-    auto buffer = (RawMessage *)iCon->message->getSendPool();
+  transport->rpc_call_dir(buffer, node_id, dir_id);
+}
+
+// ask a directory of |node_id| for a chunk: the least used one as far as
+// this thread knows, threads start from different directories
+inline void DSM::call_malloc(uint16_t node_id, int chunk_cnt) {
+  auto &s = malloc_state;
+  double best = 2;
+  for (uint32_t i = 0; i < conf.dirNR; ++i) {
+    uint16_t dir = (s.next_dir[node_id] + thread_id + i) % conf.dirNR;
+    if (s.usage(node_id, dir) < best) {
+      best = s.usage(node_id, dir);
+      s.dir_id = dir;
+    }
+  }
+  s.next_dir[node_id]++;
+  s.node_id = node_id;
+  s.sent_ns = Timer::get_time_ns();
+
+  RawMessage m;
+  m.type = RpcType::MALLOC;
+  m.chunk_cnt = chunk_cnt;
+  send_rpc(m, s.node_id, s.dir_id);
+  s.in_flight = true;
+}
 
-    memcpy(buffer, &m, sizeof(RawMessage));
-    buffer->node_id = myNodeID;
-    buffer->app_id = thread_id;
+// none if the directory has run out of chunks
+inline void DSM::take_chunks(const RawMessage *reply) {
+  auto &s = malloc_state;
+  s.used[s.node_id][s.dir_id] = reply->used_chunks;
+  s.total[s.node_id][s.dir_id] = reply->total_chunks;
 
-    iCon->sendMessage2Dir(buffer, node_id, dir_id);
+  for (int i = 0; i < reply->chunk_cnt; ++i) {
+    local_allocator.add_reserve(reply->chunks[i]);
   }
+  metrics[thread_id].record(DSMMetrics::kMallocRpc,
+                            reply->chunk_cnt * define::kChunkSize);
+}
 
-  RawMessage *rpc_wait() {
-    ibv_wc wc;
+// wait for the MALLOC in flight. a coroutine yields meanwhile, another
+// coroutine of the thread may take the reply
+inline void DSM::finish_malloc(CoroContext *cxt) {
+  auto &s = malloc_state;
+  while (s.in_flight) {
+    auto reply = cxt ? transport->rpc_poll() : transport->rpc_wait();
+    if (reply != nullptr) {
+      s.in_flight = false;
+      malloc_latency[thread_id].record(Timer::get_time_ns() - s.sent_ns);
+      take_chunks(reply);
+      break;
+    }
+    hot_wait_queue.push(cxt->coro_id);
+    (*cxt->yield)(*cxt->master);
+  }
+}
 
-    pollWithCQ(iCon->rpc_cq, 1, &wc);
-    return (RawMessage *)iCon->message->getMessage();
+// an unknown node counts as empty, ties go round-robin
+inline uint16_t DSM::least_used_node() {
+  auto &s = malloc_state;
+  uint16_t best = 0;
+  double best_ratio = 2;
+  for (uint32_t i = 0; i < conf.machineNR; ++i) {
+    uint16_t node = (s.next_node + thread_id + myNodeID + i) % conf.machineNR;
+    double ratio = s.node_usage(node, conf.dirNR);
+    if (ratio < best_ratio) {
+      best = node;
+      best_ratio = ratio;
+    }
   }
-};
+  s.next_node++;
+  return best;
+}
 
-inline GlobalAddress DSM::alloc(size_t size) {
+// well above the mean share of chunks in use: NEAR_PARENT would otherwise
+// grow the whole tree on the node of the first leaf
+inline bool DSM::crowded(uint16_t node_id) const {
+  auto &s = malloc_state;
+  double mean = 0;
+  for (uint32_t i = 0; i < conf.machineNR; ++i) {
+    mean += s.node_usage(i, conf.dirNR) / conf.machineNR;
+  }
+  return s.node_usage(node_id, conf.dirNR) > mean * 3 / 2 + 1.0 / 64;
+}
 
-  thread_local int next_target_node =
-      (getMyThreadID() + getMyNodeID()) % conf.machineNR;
-  thread_local int next_target_dir_id =
-      (getMyThreadID() + getMyNodeID()) % NR_DIRECTORY;
+// the node whose chunk is used after the one of |node|
+inline uint16_t DSM::node_after(uint16_t node) {
+  return conf.placement == Placement::ROUND_ROBIN ? (node + 1) % conf.machineNR
+                                                  : least_used_node();
+}
 
-  bool need_chunk = false;
-  auto addr = local_allocator.malloc(size, need_chunk);
-  if (need_chunk) {
-    RawMessage m;
-    m.type = RpcType::MALLOC;
+inline uint16_t DSM::chunk_node() {
+  auto &s = malloc_state;
+  if (!s.has_chunk_node) { // threads start from different nodes
+    s.chunk_node = conf.placement == Placement::ROUND_ROBIN
+                       ? (thread_id + myNodeID) % conf.machineNR
+                       : least_used_node();
+    s.has_chunk_node = true;
+  }
+  return s.chunk_node;
+}
 
-    this->rpc_call_dir(m, next_target_node, next_target_dir_id);
-    local_allocator.set_chunck(rpc_wait()->addr);
+// picked once, the chunk prefetch goes there
+inline uint16_t DSM::after_node() {
+  auto &s = malloc_state;
+  if (!s.has_after_node) {
+    s.after_node = node_after(chunk_node());
+    s.has_after_node = true;
+  }
+  return s.after_node;
+}
+
+inline void DSM::next_chunk_node() {
+  auto &s = malloc_state;
+  s.chunk_node = after_node();
+  s.has_after_node = false;
+}
+
+inline uint16_t DSM::place(size_t size, GlobalAddress hint, bool &chunked) {
+  chunked = false;
+  switch (conf.placement) {
+  case Placement::INTERLEAVE:
+    return (malloc_state.next_node++ + thread_id + myNodeID) % conf.machineNR;
+  case Placement::LEAST_USED: {
+    int node = local_allocator.reusable_node(size);
+    if (node >= 0) {
+      return node;
+    }
+    break;
+  }
+  case Placement::NEAR_PARENT:
+    if (hint != GlobalAddress::Null() && !crowded(hint.nodeID)) {
+      return hint.nodeID;
+    }
+    break;
+  default:
+    break;
+  }
+  chunked = true;
+  return chunk_node();
+}
+
+// a chunk is fetched before the current one runs out, so a split does
+// not wait for an rpc while holding its lock. chunk-sized placement moves
+// on to the next node when the chunk runs out, the chunk is fetched for
+// that node
+inline GlobalAddress DSM::alloc(size_t size, GlobalAddress hint,
+                               CoroContext *cxt) {
+  auto &s = malloc_state;
+
+  if (s.in_flight) {
+    auto reply = transport->rpc_poll();
+    if (reply != nullptr) {
+      s.in_flight = false;
+      take_chunks(reply);
+    }
+  }
+
+  bool chunked;
+  uint16_t node = place(size, hint, chunked);
+  bool need_chunk = false;
+  auto addr = local_allocator.malloc(size, node, need_chunk);
+  if (need_chunk && chunked) {
+    next_chunk_node();
+    node = chunk_node();
+    addr = local_allocator.malloc(size, node, need_chunk);
+  }
+  if (need_chunk) { // the prefetch is late or was never sent
+    metrics[thread_id].record(DSMMetrics::kMallocStall, 0);
+    if (s.in_flight) {
+      finish_malloc(cxt);
+      addr = local_allocator.malloc(size, node, need_chunk);
+    }
 
-    if (++next_target_dir_id == NR_DIRECTORY) {
-      next_target_node = (next_target_node + 1) % conf.machineNR;
-      next_target_dir_id = 0;
+    // the chunk and the reserve after it in one reply, unless the reserve
+    // belongs to the next node
+    int cnt = chunked && conf.machineNR > 1 ? 1 : define::kChunksPerMalloc;
+    // a full node gives nothing, then ask the next one
+    for (uint32_t i = 0; need_chunk && i < conf.machineNR * conf.dirNR; ++i) {
+      uint16_t n = (node + i / conf.dirNR) % conf.machineNR;
+      call_malloc(n, cnt);
+      finish_malloc(cxt);
+      addr = local_allocator.malloc(size, n, need_chunk);
+      if (!need_chunk) {
+        node = n;
+      }
+    }
+    if (need_chunk) {
+      Debug::notifyError("all memory nodes run out of chunks");
+      assert(false);
+    }
+    if (chunked) { // stay on the node which gave the chunk
+      s.chunk_node = node;
     }
+  }
+  return_empty_chunks();
 
-    // retry
-    addr = local_allocator.malloc(size, need_chunk);
+  if (!s.in_flight && local_allocator.chunk_low(node)) {
+    uint16_t next = chunked ? after_node() : node;
+    if (!local_allocator.has_reserve(next)) {
+      call_malloc(next);
+    }
   }
 
   return addr;
 }
 
-inline void DSM::free(GlobalAddress addr) { local_allocator.free(addr); }
+inline void DSM::free(GlobalAddress addr, size_t size) {
+  local_allocator.free(addr, size);
+  return_empty_chunks();
+}
+
+inline void DSM::return_empty_chunks() {
+  GlobalAddress chunk;
+  while (local_allocator.pop_empty_chunk(chunk)) {
+    free_chunk(chunk);
+  }
+}
+
+inline void DSM::free_chunk(GlobalAddress addr) {
+  RawMessage m;
+  m.type = RpcType::FREE;
+  m.addr = addr;
+
+  // no reply, no need to wait for a chunk prefetch
+  uint64_t per_directory_dsm_size = conf.dsmSize * define::GB / conf.dirNR;
+  send_rpc(m, addr.nodeID, addr.offset / per_directory_dsm_size);
+}
+
+inline void DSM::chunk_usage(uint16_t node_id, uint64_t *used,
+                             uint64_t *total) {
+  RawMessage m;
+  m.type = RpcType::ALLOC_STAT;
+
+  *used = *total = 0;
+  for (uint32_t i = 0; i < conf.dirNR; ++i) {
+    this->rpc_call_dir(m, node_id, i);
+    auto reply = rpc_wait();
+    *used += reply->used_chunks;
+    *total += reply->total_chunks;
+
+    malloc_state.used[node_id][i] = reply->used_chunks;
+    malloc_state.total[node_id][i] = reply->total_chunks;
+  }
+}
 #endif /* __DSM_H__ */
@@ -25,14 +25,14 @@ struct ExchangeMeta {
   uint64_t lockBase;
 
   ExPerThread appTh[MAX_APP_THREAD];
-  ExPerThread dirTh[NR_DIRECTORY];
+  ExPerThread dirTh[MAX_DIRECTORY];
 
   uint32_t appUdQpn[MAX_APP_THREAD];
-  uint32_t dirUdQpn[NR_DIRECTORY];
+  uint32_t dirUdQpn[MAX_DIRECTORY];
 
-  uint32_t appRcQpn2dir[MAX_APP_THREAD][NR_DIRECTORY];
+  uint32_t appRcQpn2dir[MAX_APP_THREAD][MAX_DIRECTORY];
 
-  uint32_t dirRcQpn2app[NR_DIRECTORY][MAX_APP_THREAD];
+  uint32_t dirRcQpn2app[MAX_DIRECTORY][MAX_APP_THREAD];
 
 } __attribute__((packed));
 
@@ -45,6 +45,7 @@ private:
   ThreadConnection **thCon;
   DirectoryConnection **dirCon;
   RemoteConnection *remoteCon;
+  uint32_t dirNR;
 
   ExchangeMeta localMeta;
 
@@ -71,9 +72,9 @@ protected:
 
 public:
   DSMKeeper(ThreadConnection **thCon, DirectoryConnection **dirCon, RemoteConnection *remoteCon,
-            uint32_t maxServer = 12)
+            uint32_t maxServer = 12, uint32_t dirNR = 1)
       : Keeper(maxServer), thCon(thCon), dirCon(dirCon),
-        remoteCon(remoteCon) {
+        remoteCon(remoteCon), dirNR(dirNR) {
 
     initLocalMeta();
 
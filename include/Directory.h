@@ -13,11 +13,21 @@
 
 class Directory {
 public:
+  // directory |dirID| of |dirNR| owns the dirID-th slice of the memory
   Directory(DirectoryConnection *dCon, RemoteConnection *remoteInfo,
-            uint32_t machineNR, uint16_t dirID, uint16_t nodeID);
+            uint32_t machineNR, uint16_t dirID, uint32_t dirNR,
+            uint16_t nodeID);
+
+  // emulated memory node: no connection and no polling thread,
+  // messages are served by the caller through |serve|
+  Directory(uint64_t dsmSize, uint16_t dirID, uint32_t dirNR,
+            uint16_t nodeID);
 
   ~Directory();
 
+  // return true if |m| needs a reply
+  bool serve(const RawMessage *m, RawMessage *reply);
+
 private:
   DirectoryConnection *dCon;
   RemoteConnection *remoteInfo;
@@ -30,6 +40,7 @@ private:
 
   GlobalAllocator *chunckAlloc;
 
+  void init_allocator(uint64_t dsmSize, uint32_t dirNR);
   void dirThread();
 
   void sendData2App(const RawMessage *m);
@@ -0,0 +1,102 @@
+#if !defined(_EMULATED_TRANSPORT_H_)
+#define _EMULATED_TRANSPORT_H_
+
+#include "Transport.h"
+
+class Directory;
+
+// memory nodes emulated inside one process (for single-host runs):
+// each node owns a slice of one hugepage region and a small array that
+// stands in for the on-chip memory of its RNIC.
+// remote addresses handed out by DSM are plain virtual addresses here.
+class EmulatedFabric {
+public:
+  EmulatedFabric(uint32_t machineNR, uint64_t dsmSize, uint32_t dirNR);
+  ~EmulatedFabric();
+
+  uint64_t dsm_base(uint16_t node_id) const {
+    return (uint64_t)dsmPool + node_id * dsmSize;
+  }
+  uint64_t lock_base(uint16_t node_id) const {
+    return (uint64_t)lockPool + node_id * define::kLockChipMemSize;
+  }
+
+  // directory threads are emulated by the calling app thread
+  bool serve_rpc(const RawMessage &m, uint16_t node_id, uint16_t dir_id,
+                 RawMessage *reply);
+
+private:
+  uint32_t machineNR;
+  uint64_t dsmSize; // per node, byte
+  uint32_t dirNR;
+
+  char *dsmPool;
+  char *lockPool;
+
+  Directory *dirAgent[MAX_MACHINE][MAX_DIRECTORY];
+  WRLock dirLock[MAX_MACHINE][MAX_DIRECTORY];
+};
+
+// verbs are executed in place by the issuing thread (memcpy and atomics),
+// signaled ones then post their wr_id to a per-thread completion queue,
+// so synchronous and coroutine callers see the same completion order
+// as with RC queue pairs.
+class EmulatedTransport : public Transport {
+public:
+  EmulatedTransport(EmulatedFabric *fabric);
+
+  bool read(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t size,
+            uint32_t remoteRKey, bool signal = true,
+            uint64_t wrID = 0) override;
+  bool write(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t size,
+             uint32_t remoteRKey, bool signal = true,
+             uint64_t wrID = 0) override;
+
+  bool cas(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t compare,
+           uint64_t swap, uint32_t remoteRKey, bool signal = true,
+           uint64_t wrID = 0) override;
+  bool cas_mask(uint16_t node_id, uint64_t source, uint64_t dest,
+                uint64_t compare, uint64_t swap, uint32_t remoteRKey,
+                uint64_t mask = ~(0ull), bool signal = true) override;
+  bool faa_boundary(uint16_t node_id, uint64_t source, uint64_t dest,
+                    uint64_t add, uint32_t remoteRKey, uint64_t boundary = 63,
+                    bool signal = true, uint64_t wrID = 0) override;
+
+  bool write_batch(uint16_t node_id, RdmaOpRegion *ror, int k, bool signal,
+                   uint64_t wrID = 0) override;
+  bool read_batch(uint16_t node_id, RdmaOpRegion *ror, int k, bool signal,
+                  uint64_t wrID = 0) override;
+  bool cas_read(uint16_t node_id, const RdmaOpRegion &cas_ror,
+                const RdmaOpRegion &read_ror, uint64_t compare, uint64_t swap,
+                bool signal, uint64_t wrID = 0) override;
+  bool write_faa(uint16_t node_id, const RdmaOpRegion &write_ror,
+                 const RdmaOpRegion &faa_ror, uint64_t add_val, bool signal,
+                 uint64_t wrID = 0) override;
+  bool write_cas(uint16_t node_id, const RdmaOpRegion &write_ror,
+                 const RdmaOpRegion &cas_ror, uint64_t compare, uint64_t swap,
+                 bool signal, uint64_t wrID = 0) override;
+
+  uint64_t poll_cq(int count = 1) override;
+  bool poll_cq_once(uint64_t &wr_id) override;
+
+  void rpc_call_dir(const RawMessage &m, uint16_t node_id,
+                    uint16_t dir_id = 0) override;
+  RawMessage *rpc_wait() override;
+  RawMessage *rpc_poll() override;
+
+private:
+  static const int kCqDepth = 1024;
+
+  EmulatedFabric *fabric;
+
+  uint64_t cq[kCqDepth];
+  uint32_t cq_head;
+  uint32_t cq_tail;
+
+  RawMessage reply;
+  int reply_cnt;
+
+  void complete(bool signal, uint64_t wrID);
+};
+
+#endif // _EMULATED_TRANSPORT_H_
@@ -0,0 +1,175 @@
+#if !defined(_EPOCH_H_)
+#define _EPOCH_H_
+
+#include "Common.h"
+#include "Debug.h"
+#include "HugePageAlloc.h"
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// epoch-based reclamation of objects that readers may still hold.
+// a reader announces the global epoch while it holds such pointers, one
+// announcement per thread: readers never yield while holding them, so two
+// coroutines of a thread are never inside at once. an object retired in
+// epoch e is freed once the global epoch reaches e + 2, i.e. every reader
+// announced after it was unlinked. no locks: announcing is a store and a
+// fence, and every thread frees what it retired, a batch every kRetireBatch
+// retirements
+class Epoch {
+public:
+  static const int kMaxThread = MAX_APP_THREAD;
+  static const int kRetireBatch = 64;
+
+  // |reclaim| is called on every retired object when it is safe to free,
+  // on the thread which retired it
+  Epoch(std::function<void(void *)> reclaim);
+
+  void enter();
+  void exit();
+
+  // |p| is unlinked, free it after the current readers are gone
+  void retire(void *p);
+
+  uint64_t epoch() const { return global.load(); }
+  uint64_t retired() const; // not reclaimed yet
+
+  // pointers read within the scope are valid until its end
+  class Guard {
+  public:
+    Guard(Epoch &epoch) : epoch(epoch) { epoch.enter(); }
+    ~Guard() { epoch.exit(); }
+
+  private:
+    Epoch &epoch;
+  };
+
+  // small id of the calling thread, reused after the thread exits
+  static int thread_id();
+
+private:
+  static const uint64_t kIdle = UINT64_MAX;
+
+  struct Local {
+    std::atomic<uint64_t> announce; // kIdle if outside
+    int depth;                      // nested enter(), owner only
+  } __attribute__((aligned(define::kCacheLineSize)));
+
+  struct Retired {
+    void *p;
+    uint64_t epoch;
+  };
+
+  std::atomic<uint64_t> global;
+  Local *locals; // kMaxThread
+  std::vector<Retired> retired_list[kMaxThread];
+  std::function<void(void *)> reclaim;
+
+  bool try_advance();
+  void collect(int tid);
+};
+
+inline Epoch::Epoch(std::function<void(void *)> reclaim)
+    : global(0), reclaim(reclaim) {
+  locals = (Local *)hugePageAlloc(sizeof(Local) * kMaxThread);
+  for (int i = 0; i < kMaxThread; ++i) {
+    locals[i].announce.store(kIdle);
+    locals[i].depth = 0;
+  }
+}
+
+inline int Epoch::thread_id() {
+  static std::atomic<bool> used[kMaxThread];
+
+  struct Id {
+    int id;
+    Id() : id(-1) {
+      for (int i = 0; i < kMaxThread; ++i) {
+        bool f = false;
+        if (!used[i].load() && used[i].compare_exchange_strong(f, true)) {
+          id = i;
+          return;
+        }
+      }
+      Debug::notifyError("more than %d threads use epochs", kMaxThread);
+      ::exit(-1);
+    }
+    ~Id() { used[id].store(false); }
+  };
+  static thread_local Id id;
+
+  return id.id;
+}
+
+inline void Epoch::enter() {
+  auto &l = locals[thread_id()];
+  if (l.depth++ != 0) {
+    return;
+  }
+
+  // the announcement is seen by try_advance() before we read anything
+  uint64_t e = global.load(std::memory_order_relaxed);
+  while (true) {
+    l.announce.store(e, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t now = global.load(std::memory_order_relaxed);
+    if (now == e) {
+      break;
+    }
+    e = now;
+  }
+}
+
+inline void Epoch::exit() {
+  auto &l = locals[thread_id()];
+  if (--l.depth == 0) {
+    l.announce.store(kIdle, std::memory_order_release);
+  }
+}
+
+inline void Epoch::retire(void *p) {
+  int tid = thread_id();
+  auto &list = retired_list[tid];
+  std::atomic_thread_fence(std::memory_order_seq_cst); // after the unlink
+  list.push_back({p, global.load(std::memory_order_relaxed)});
+  if (list.size() % kRetireBatch == 0) {
+    try_advance();
+    collect(tid);
+  }
+}
+
+// the global epoch moves on once every reader announced it
+inline bool Epoch::try_advance() {
+  uint64_t e = global.load();
+  for (int i = 0; i < kMaxThread; ++i) {
+    uint64_t a = locals[i].announce.load(std::memory_order_relaxed);
+    if (a != kIdle && a != e) {
+      return false;
+    }
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return global.compare_exchange_strong(e, e + 1);
+}
+
+// the list is in retirement order, so epochs never decrease along it
+inline void Epoch::collect(int tid) {
+  auto &list = retired_list[tid];
+  uint64_t e = global.load();
+  size_t n = 0;
+  while (n < list.size() && list[n].epoch + 2 <= e) {
+    reclaim(list[n].p);
+    n++;
+  }
+  list.erase(list.begin(), list.begin() + n);
+}
+
+inline uint64_t Epoch::retired() const {
+  uint64_t sum = 0;
+  for (int i = 0; i < kMaxThread; ++i) {
+    sum += retired_list[i].size();
+  }
+  return sum;
+}
+
+#endif // _EPOCH_H_
@@ -6,12 +6,14 @@
 #include "GlobalAddress.h"
 
 #include <cstring>
+#include <vector>
 
 
 
-// global allocator for coarse-grained (chunck level) alloc 
-// used by home agent
-// bitmap based
+// global allocator for coarse-grained (chunck level) alloc
+// used by home agent (one directory thread, not thread safe).
+// freed chunks are reused first, most recently freed first, then the
+// never used ones; the bitmap catches double and wild frees
 class GlobalAllocator {
 
 public:
@@ -20,46 +22,64 @@ public:
     bitmap_len = size / define::kChunkSize;
     bitmap = new bool[bitmap_len];
     memset(bitmap, 0, bitmap_len);
-     
+
     // null ptr
     bitmap[0] = true;
     bitmap_tail = 1;
+    used_cnt = 1;
   }
 
   ~GlobalAllocator() { delete[] bitmap; }
 
+  // GlobalAddress::Null() if all chunks are used
   GlobalAddress alloc_chunck() {
 
-    GlobalAddress res = start;
-    if (bitmap_tail >= bitmap_len) {
-      assert(false);
+    size_t i;
+    if (!free_list.empty()) {
+      i = free_list.back();
+      free_list.pop_back();
+    } else if (bitmap_tail < bitmap_len) {
+      i = bitmap_tail++;
+    } else {
       Debug::notifyError("shared memory space run out");
+      return GlobalAddress::Null();
     }
 
-    if (bitmap[bitmap_tail] == false) {
-      bitmap[bitmap_tail] = true;
-      res.offset += bitmap_tail * define::kChunkSize;
-
-      bitmap_tail++;
-    } else {
-      assert(false);
-      Debug::notifyError("TODO");
-    }
+    assert(bitmap[i] == false);
+    bitmap[i] = true;
+    used_cnt++;
 
+    GlobalAddress res = start;
+    res.offset += i * define::kChunkSize;
     return res;
   }
 
   void free_chunk(const GlobalAddress &addr) {
-    bitmap[(addr.offset - start.offset) / define::kChunkSize] = false;
+    size_t i = (addr.offset - start.offset) / define::kChunkSize;
+    if (addr.offset < start.offset || i == 0 || i >= bitmap_tail ||
+        bitmap[i] == false) {
+      Debug::notifyError("free a chunk which is not allocated");
+      return;
+    }
+
+    bitmap[i] = false;
+    used_cnt--;
+    free_list.push_back(i);
   }
 
+  // chunks in use (the null chunk included) and all chunks
+  uint64_t used_chunks() const { return used_cnt; }
+  uint64_t total_chunks() const { return bitmap_len; }
+
 private:
   GlobalAddress start;
   size_t size;
 
   bool *bitmap;
   size_t bitmap_len;
-  size_t bitmap_tail;
+  size_t bitmap_tail; // chunks from here on were never used
+  uint64_t used_cnt;
+  std::vector<size_t> free_list;
 };
 
 #endif
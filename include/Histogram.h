@@ -0,0 +1,92 @@
+#if !defined(_HISTOGRAM_H_)
+#define _HISTOGRAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "Common.h"
+
+// log-linear latency histogram (HdrHistogram-like), in ns.
+// values below 2^kSubBits are exact; above, every power-of-two range is
+// split into 2^(kSubBits - 1) linear buckets, i.e. <= 1/64 relative error.
+// ~30KB, record() touches one bucket; one instance per thread, merged
+// by the reader (without stopping the writers)
+class LatencyHistogram {
+public:
+  static const int kSubBits = 7;
+  static const int kSubCount = 1 << kSubBits;
+  static const int kHalfCount = kSubCount / 2;
+  static const int kBucketCount = kSubCount + (64 - kSubBits) * kHalfCount;
+
+  LatencyHistogram() { clear(); }
+
+  void record(uint64_t ns) {
+    counts[index_of(ns)]++;
+    total++;
+    if (ns > max) {
+      max = ns;
+    }
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (int i = 0; i < kBucketCount; ++i) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    max = std::max(max, other.max);
+  }
+
+  void clear() {
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    max = 0;
+  }
+
+  uint64_t count() const { return total; }
+  uint64_t max_value() const { return max; }
+
+  // smallest recorded bucket that covers p (0 ~ 100) percent of all
+  // values, reported as the bucket's upper edge
+  uint64_t percentile(double p) const {
+    if (total == 0) {
+      return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, total * p / 100);
+    uint64_t cum = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+      cum += counts[i];
+      if (cum >= target) {
+        return std::min(upper_edge(i), max);
+      }
+    }
+    return max;
+  }
+
+  static int index_of(uint64_t v) {
+    if (v < (uint64_t)kSubCount) {
+      return v;
+    }
+    int e = 63 - __builtin_clzll(v); // v in [2^e, 2^(e+1))
+    int g = e - kSubBits + 1;        // >= 1
+    int sub = (v >> g) - kHalfCount; // [0, kHalfCount)
+    return kSubCount + (g - 1) * kHalfCount + sub;
+  }
+
+  static uint64_t upper_edge(int i) {
+    if (i < kSubCount) {
+      return i;
+    }
+    int g = (i - kSubCount) / kHalfCount + 1;
+    uint64_t sub = (i - kSubCount) % kHalfCount;
+    return ((kHalfCount + sub + 1) << g) - 1;
+  }
+
+private:
+  uint64_t counts[kBucketCount];
+  uint64_t total;
+  uint64_t max;
+} __attribute__((aligned(define::kCacheLineSize)));
+
+#endif // _HISTOGRAM_H_
@@ -2,6 +2,7 @@
 #define __HUGEPAGEALLOC_H__
 
 
+#include <atomic>
 #include <cstdint>
 
 #include <sys/mman.h>
@@ -14,7 +15,20 @@ inline void *hugePageAlloc(size_t size) {
     void *res = mmap(NULL, size, PROT_READ | PROT_WRITE,
                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
     if (res == MAP_FAILED) {
-        Debug::notifyError("%s mmap failed!\n", getIP());
+        // no huge pages reserved (e.g., single-host emulated runs), or not
+        // enough for |size|; told once, small callers would flood the log
+        static std::atomic<bool> told(false);
+        if (!told.exchange(true)) {
+            Debug::notifyInfo("%s no huge pages (%ld bytes), fall back to "
+                              "4KB pages",
+                              getIP(), size);
+        }
+
+        res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (res == MAP_FAILED) {
+            Debug::notifyError("%s mmap failed!\n", getIP());
+        }
     }
 
     return res;
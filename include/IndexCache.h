@@ -1,14 +1,16 @@
 #if !defined(_INDEX_CACHE_H_)
 #define _INDEX_CACHE_H_
 
+#include "CacheBTree.h"
 #include "CacheEntry.h"
+#include "Epoch.h"
 #include "HugePageAlloc.h"
+#include "PageArena.h"
 #include "Timer.h"
-#include "WRLock.h"
 #include "third_party/inlineskiplist.h"
 
+#include <algorithm>
 #include <atomic>
-#include <queue>
 #include <vector>
 
 extern bool enter_debug;
@@ -18,22 +20,56 @@ using CacheSkipList = InlineSkipList<CacheEntryComparator>;
 class IndexCache {
 
 public:
-  IndexCache(int cache_size);
+  // index over the cached pages of a level
+  enum Backend {
+    kSkipList,
+    kBTree, // CacheBTree, fewer cache misses per lookup
+  };
 
-  bool add_to_cache(InternalPage *page);
-  const CacheEntry *search_from_cache(const Key &k, GlobalAddress *addr,
-                                      bool is_leader = false);
+  IndexCache(int cache_size, Backend backend = kSkipList);
+
+  // internal pages of any level (1 ~ kMaxLevel - 1) are cached,
+  // each level in its own skiplist and page budget
+  static const int kMaxLevel = define::kMaxLevelOfTree;
+  // pages sampled to pick a victim
+  static const int kEvictSample = 8;
 
+  bool add_to_cache(InternalPage *page);
+  // level-1 page covering k: the leaf of k in *addr
+  const CacheEntry *search_from_cache(const Key &k, GlobalAddress *addr);
+  // the deepest cached page above level 1 covering k: the child of k
+  // in *addr and the level of the page in *level
+  const CacheEntry *search_upper_from_cache(const Key &k, GlobalAddress *addr,
+                                            int *level);
+
+  // hold an Epoch::Guard while using the pages
   void search_range_from_cache(const Key &from, const Key &to,
                                std::vector<InternalPage *> &result);
 
-  bool add_entry(const Key &from, const Key &to, InternalPage *ptr);
-  const CacheEntry *find_entry(const Key &k);
-  const CacheEntry *find_entry(const Key &from, const Key &to);
+  bool add_entry(const Key &from, const Key &to, InternalPage *ptr,
+                 const CacheEntry **entry = nullptr);
+  const CacheEntry *find_entry(const Key &k, int level = 1);
+  const CacheEntry *find_entry(const Key &from, const Key &to, int level = 1);
 
   bool invalidate(const CacheEntry *entry);
 
-  const CacheEntry *get_a_random_entry(uint64_t &freq);
+  // the cached pages of |level|, hold an Epoch::Guard while using them
+  void cached_entries(int level, std::vector<const CacheEntry *> &result);
+
+  // write the cached pages (fence keys and versions included) to |path|,
+  // upper levels first. load() adds them back in a later run; a stale
+  // page is found on use like any other, or by Tree::revalidate_index_cache
+  bool snapshot(const char *path);
+  // pages added, -1 if |path| is not a snapshot
+  int64_t load(const char *path);
+
+  // cached pages, page budget and evictions of |level|
+  int64_t occupancy(int level) const { return page_cnt[level].load(); }
+  int64_t budget(int level) const { return level_page_cnt[level]; }
+  uint64_t evictions(int level) const { return evict_cnt[level].load(); }
+
+  // an invalidated page copy is freed once no reader can see it
+  Epoch &epoch() { return page_epoch; }
 
   void statistics();
 
@@ -41,51 +77,129 @@ public:
 
 private:
   uint64_t cache_size; // MB;
-  std::atomic<int64_t> free_page_cnt;
   std::atomic<int64_t> skiplist_node_cnt;
   int64_t all_page_cnt;
+  int64_t level_page_cnt[kMaxLevel]; // budget
+
+  // the pages of a level sit in a dense array of level_page_cnt slots.
+  // a new page takes a never used slot, else the slot of an invalidated
+  // page or of the least frequently used of kEvictSample random pages
+  // (sampled LFU), so a victim is found in O(1) whatever the keys are.
+  // a refilled entry stays in its slot (CacheEntry::slot)
+  std::atomic<const CacheEntry *> *slots[kMaxLevel];
+  std::atomic<uint64_t> fill_cnt[kMaxLevel]; // slots taken, may exceed
+  std::atomic<int64_t> page_cnt[kMaxLevel];
+  std::atomic<uint64_t> evict_cnt[kMaxLevel];
+
+  Epoch page_epoch;
+  // page copies, malloc() if it runs out
+  PageArena *page_arena;
+
+  Backend backend;
+  // SkipList or BTree, one per level
+  CacheSkipList *skiplist[kMaxLevel];
+  CacheBTree *btree[kMaxLevel];
+  CacheEntryComparator cmp;
+  Allocator alloc; // entries, from hugepages
 
-  std::queue<std::pair<void *, uint64_t>> delay_free_list;
-  WRLock free_lock;
+  struct SnapshotHeader {
+    uint64_t magic;
+    uint32_t page_size;
+    uint32_t max_level;
+    uint64_t page_cnt;
+  };
+  static const uint64_t kSnapshotMagic = 0x31584449434d4853; // "SHMCIDX1"
 
-  // SkipList
-  CacheSkipList *skiplist;
-  CacheEntryComparator cmp;
-  Allocator alloc;
+  void install(const CacheEntry *entry, int level);
 
-  void evict_one();
+  InternalPage *alloc_page();
+  void free_page(InternalPage *page);
 };
 
-inline IndexCache::IndexCache(int cache_size) : cache_size(cache_size) {
-  skiplist = new CacheSkipList(cmp, &alloc, 21);
+inline IndexCache::IndexCache(int cache_size, Backend backend)
+    : cache_size(cache_size),
+      page_epoch([this](void *p) { free_page((InternalPage *)p); }),
+      backend(backend) {
   uint64_t memory_size = define::MB * cache_size;
-
   all_page_cnt = memory_size / sizeof(InternalPage);
-  free_page_cnt.store(all_page_cnt);
+
+  // a level has about fanout times fewer pages than the level below,
+  // so level 1 gets 7/8 of the pages and each upper level 1/8 of the
+  // level below it
+  // the budget, plus the pages retired but not yet reclaimed and those
+  // in the caches of the threads
+  page_arena = new PageArena(kInternalPageSize,
+                             all_page_cnt + all_page_cnt / 4 +
+                                 Epoch::kMaxThread * PageArena::kThreadCache);
+
+  int64_t budget = all_page_cnt * 7 / 8;
+  for (int i = 0; i < kMaxLevel; ++i) {
+    bool used = i != 0;
+    skiplist[i] = used && backend == kSkipList
+                      ? new CacheSkipList(cmp, &alloc, 21)
+                      : nullptr;
+    btree[i] = used && backend == kBTree ? new CacheBTree : nullptr;
+    level_page_cnt[i] = i == 0 ? 0 : std::max<int64_t>(budget, 64);
+    if (i > 0) {
+      budget /= 8;
+    }
+
+    slots[i] = new std::atomic<const CacheEntry *>[level_page_cnt[i]];
+    for (int64_t k = 0; k < level_page_cnt[i]; ++k) {
+      slots[i][k].store(nullptr);
+    }
+    fill_cnt[i].store(0);
+    page_cnt[i].store(0);
+    evict_cnt[i].store(0);
+  }
   skiplist_node_cnt.store(0);
 }
 
 // [from, to）
 inline bool IndexCache::add_entry(const Key &from, const Key &to,
-                                  InternalPage *ptr) {
+                                  InternalPage *ptr,
+                                  const CacheEntry **entry) {
+  // entries are never freed: add_to_cache() looks for the range first,
+  // only an insert racing with another of the same range loses one
+  if (backend == kBTree) {
+    auto e = (CacheEntry *)alloc.Allocate(sizeof(CacheEntry));
+    e->from = from;
+    e->to = to - 1;
+    e->ptr = ptr;
+    e->slot = UINT64_MAX;
+    if (!btree[ptr->hdr.level]->insert(e)) {
+      return false;
+    }
+    if (entry) {
+      *entry = e;
+    }
+    return true;
+  }
 
-  // TODO memory leak
-  auto buf = skiplist->AllocateKey(sizeof(CacheEntry));
+  auto list = skiplist[ptr->hdr.level];
+  auto buf = list->AllocateKey(sizeof(CacheEntry));
   auto &e = *(CacheEntry *)buf;
   e.from = from;
   e.to = to - 1; // !IMPORTANT;
   e.ptr = ptr;
+  e.slot = UINT64_MAX;
+  if (entry) {
+    *entry = &e;
+  }
 
-  return skiplist->InsertConcurrently(buf);
+  return list->InsertConcurrently(buf);
 }
 
-inline const CacheEntry *IndexCache::find_entry(const Key &from,
-                                                const Key &to) {
-  CacheSkipList::Iterator iter(skiplist);
-
+inline const CacheEntry *IndexCache::find_entry(const Key &from, const Key &to,
+                                                int level) {
   CacheEntry e;
   e.from = from;
   e.to = to - 1;
+  if (backend == kBTree) {
+    return btree[level]->lower_bound(e);
+  }
+
+  CacheSkipList::Iterator iter(skiplist[level]);
   iter.Seek((char *)&e);
   if (iter.Valid()) {
     auto val = (const CacheEntry *)iter.key();
@@ -95,58 +209,55 @@ inline const CacheEntry *IndexCache::find_entry(const Key &from,
   }
 }
 
-inline const CacheEntry *IndexCache::find_entry(const Key &k) {
-  return find_entry(k, k + 1);
+inline const CacheEntry *IndexCache::find_entry(const Key &k, int level) {
+  return find_entry(k, k + 1, level);
 }
 
 inline bool IndexCache::add_to_cache(InternalPage *page) {
-  auto new_page = (InternalPage *)malloc(kInternalPageSize);
+  int level = page->hdr.level;
+  if (level < 1 || level >= kMaxLevel) {
+    return false;
+  }
+
+  Epoch::Guard guard(page_epoch);
+
+  // an entry of the same range is refilled, entries are never unlinked
+  auto e = this->find_entry(page->hdr.lowest, page->hdr.highest, level);
+  bool found =
+      e && e->from == page->hdr.lowest && e->to == page->hdr.highest - 1;
+  if (found && e->ptr != nullptr) {
+    return false;
+  }
+
+  auto new_page = alloc_page();
   memcpy(new_page, page, kInternalPageSize);
   new_page->index_cache_freq = 0;
 
-  if (this->add_entry(page->hdr.lowest, page->hdr.highest, new_page)) {
+  const CacheEntry *entry;
+  if (!found &&
+      this->add_entry(page->hdr.lowest, page->hdr.highest, new_page, &entry)) {
     skiplist_node_cnt.fetch_add(1);
-    auto v = free_page_cnt.fetch_add(-1);
-    if (v <= 0) {
-      evict_one();
-    }
+    install(entry, level);
 
     return true;
-  } else { // conflicted
-    auto e = this->find_entry(page->hdr.lowest, page->hdr.highest);
-    if (e && e->from == page->hdr.lowest && e->to == page->hdr.highest - 1) {
-      auto ptr = e->ptr;
-      if (ptr == nullptr &&
-          __sync_bool_compare_and_swap(&(e->ptr), 0ull, new_page)) {
-        auto v = free_page_cnt.fetch_add(-1);
-        if (v <= 0) {
-          evict_one();
-        }
-        return true;
-      }
-    }
+  }
 
-    free(new_page);
-    return false;
+  if (!found) { // conflicted
+    e = this->find_entry(page->hdr.lowest, page->hdr.highest, level);
+    found = e && e->from == page->hdr.lowest && e->to == page->hdr.highest - 1;
+  }
+  if (found && __sync_bool_compare_and_swap(&(e->ptr), 0ull, new_page)) {
+    install(e, level);
+    return true;
   }
+
+  free_page(new_page); // never seen by others
+  return false;
 }
 
 inline const CacheEntry *IndexCache::search_from_cache(const Key &k,
-                                                       GlobalAddress *addr,
-                                                       bool is_leader) {
-  // notice: please ensure the thread 0 can make progress
-  if (is_leader &&
-      !delay_free_list.empty()) { // try to free a page in the delay-free-list
-    auto p = delay_free_list.front();
-    if (asm_rdtsc() - p.second > 3000ull * 10) {
-      free(p.first);
-      free_page_cnt.fetch_add(1);
-
-      free_lock.wLock();
-      delay_free_list.pop();
-      free_lock.wUnlock();
-    }
-  }
+                                                       GlobalAddress *addr) {
+  Epoch::Guard guard(page_epoch);
 
   auto entry = find_entry(k);
 
@@ -156,23 +267,7 @@ inline const CacheEntry *IndexCache::search_from_cache(const Key &k,
 
     page->index_cache_freq++;
 
-    auto cnt = page->hdr.last_index + 1;
-    if (k < page->records[0].key) {
-      *addr = page->hdr.leftmost_ptr;
-    } else {
-
-      bool find = false;
-      for (int i = 1; i < cnt; ++i) {
-        if (k < page->records[i].key) {
-          find = true;
-          *addr = page->records[i - 1].ptr;
-          break;
-        }
-      }
-      if (!find) {
-        *addr = page->records[cnt - 1].ptr;
-      }
-    }
+    *addr = page->child(k);
 
     compiler_barrier();
     if (entry->ptr) { // check if it is freed.
@@ -183,15 +278,56 @@ inline const CacheEntry *IndexCache::search_from_cache(const Key &k,
   return nullptr;
 }
 
+// upper levels are few pages, the lookups stay in cache;
+// a stale entry shows up as a child whose fence keys do not cover k
+inline const CacheEntry *
+IndexCache::search_upper_from_cache(const Key &k, GlobalAddress *addr,
+                                    int *level) {
+  Epoch::Guard guard(page_epoch);
+
+  for (int l = 2; l < kMaxLevel; ++l) {
+    auto entry = find_entry(k, l);
+
+    InternalPage *page = entry ? entry->ptr : nullptr;
+    if (page && entry->from <= k && entry->to >= k) {
+      page->index_cache_freq++;
+
+      *addr = page->child(k);
+      *level = l;
+
+      compiler_barrier();
+      if (entry->ptr) { // check if it is freed.
+        return entry;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
 inline void
 IndexCache::search_range_from_cache(const Key &from, const Key &to,
                                     std::vector<InternalPage *> &result) {
-  CacheSkipList::Iterator iter(skiplist);
-
   result.clear();
   CacheEntry e;
   e.from = from;
   e.to = from;
+
+  if (backend == kBTree) {
+    for (auto val = btree[1]->lower_bound(e); val;
+         val = btree[1]->upper_bound(*val)) {
+      auto ptr = val->ptr;
+      if (ptr) {
+        if (val->from > to) {
+          return;
+        }
+        result.push_back(ptr);
+      }
+    }
+    return;
+  }
+
+  CacheSkipList::Iterator iter(skiplist[1]);
   iter.Seek((char *)&e);
 
   while (iter.Valid()) {
@@ -207,60 +343,203 @@ IndexCache::search_range_from_cache(const Key &from, const Key &to,
 }
 
 inline bool IndexCache::invalidate(const CacheEntry *entry) {
+  Epoch::Guard guard(page_epoch);
+
   auto ptr = entry->ptr;
 
   if (ptr == nullptr) {
     return false;
   }
 
+  int level = ptr->hdr.level;
   if (__sync_bool_compare_and_swap(&(entry->ptr), ptr, 0)) {
-
-    free_lock.wLock();
-    delay_free_list.push(std::make_pair(ptr, asm_rdtsc()));
-    free_lock.wUnlock();
+    page_cnt[level].fetch_add(-1);
+    page_epoch.retire(ptr);
     return true;
   }
 
   return false;
 }
 
-inline const CacheEntry *IndexCache::get_a_random_entry(uint64_t &freq) {
-  uint32_t seed = asm_rdtsc();
-  GlobalAddress tmp_addr;
-retry:
-  auto k = rand_r(&seed) % (1000ull * define::MB);
-  auto e = this->search_from_cache(k, &tmp_addr);
-  if (!e) {
-    goto retry;
+// |entry| (just added or refilled) takes a slot of |level|. a refilled
+// entry keeps its old slot unless another page has taken it, so an entry
+// is in one slot at most
+inline void IndexCache::install(const CacheEntry *entry, int level) {
+  page_cnt[level].fetch_add(1);
+
+  auto s = slots[level];
+  uint64_t cap = level_page_cnt[level];
+  if (entry->slot < cap && s[entry->slot].load() == entry) {
+    return;
   }
-  auto ptr = e->ptr;
-  if (!ptr) {
-    goto retry;
+  if (fill_cnt[level].load(std::memory_order_relaxed) < cap) {
+    auto i = fill_cnt[level].fetch_add(1);
+    if (i < cap) {
+      entry->slot = i;
+      s[i].store(entry);
+      return;
+    }
   }
 
-  freq = ptr->index_cache_freq;
-  if (e->ptr != ptr) {
-    goto retry;
+  Epoch::Guard guard(page_epoch);
+
+  static thread_local uint64_t seed = asm_rdtsc();
+  while (true) {
+    uint64_t victim = 0;
+    const CacheEntry *victim_entry = nullptr;
+    InternalPage *victim_page = nullptr;
+    uint64_t victim_freq = UINT64_MAX;
+    for (int k = 0; k < kEvictSample; ++k) {
+      seed ^= seed << 13; // xorshift
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      uint64_t i = seed % cap;
+
+      auto e = s[i].load();
+      InternalPage *ptr = e ? e->ptr : nullptr;
+      if (ptr == nullptr) { // invalidated, or being filled
+        if (e) {
+          victim = i;
+          victim_entry = e;
+          victim_page = nullptr;
+          break;
+        }
+        continue;
+      }
+
+      uint64_t freq = ptr->index_cache_freq;
+      if (freq < victim_freq) {
+        victim = i;
+        victim_entry = e;
+        victim_page = ptr;
+        victim_freq = freq;
+      }
+      ptr->index_cache_freq = freq / 2; // aging of the sampled pages
+    }
+    if (victim_entry == nullptr ||
+        !s[victim].compare_exchange_strong(victim_entry, entry)) {
+      continue;
+    }
+
+    entry->slot = victim;
+
+    // an invalidated victim may have been refilled meanwhile, and kept
+    // this slot: without a slot it is never evicted, drop it
+    if ((victim_page || victim_entry->ptr) && invalidate(victim_entry)) {
+      evict_cnt[level].fetch_add(1);
+    }
+    return;
   }
-  return e;
 }
 
-inline void IndexCache::evict_one() {
+inline void
+IndexCache::cached_entries(int level,
+                           std::vector<const CacheEntry *> &result) {
+  result.clear();
+  uint64_t n = std::min<uint64_t>(fill_cnt[level].load(),
+                                  level_page_cnt[level]);
+  for (uint64_t i = 0; i < n; ++i) {
+    auto e = slots[level][i].load();
+    if (e && e->ptr) {
+      result.push_back(e);
+    }
+  }
+}
+
+inline bool IndexCache::snapshot(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == nullptr) {
+    Debug::notifyError("can not open %s", path);
+    return false;
+  }
+
+  SnapshotHeader h;
+  h.magic = kSnapshotMagic;
+  h.page_size = kInternalPageSize;
+  h.max_level = kMaxLevel;
+  h.page_cnt = 0;
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+  Epoch::Guard guard(page_epoch);
+  std::vector<const CacheEntry *> entries;
+  for (int l = kMaxLevel - 1; l >= 1 && ok; --l) {
+    cached_entries(l, entries);
+    for (auto e : entries) {
+      auto page = e->ptr;
+      if (page) {
+        ok = ok && fwrite(page, kInternalPageSize, 1, f) == 1;
+        h.page_cnt++;
+      }
+    }
+  }
+
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    Debug::notifyError("write %s failed", path);
+  }
+  return ok;
+}
 
-  uint64_t freq1, freq2;
-  auto e1 = get_a_random_entry(freq1);
-  auto e2 = get_a_random_entry(freq2);
+inline int64_t IndexCache::load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr) {
+    return -1;
+  }
+
+  SnapshotHeader h;
+  if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != kSnapshotMagic ||
+      h.page_size != kInternalPageSize) {
+    Debug::notifyError("%s is not an index cache snapshot", path);
+    fclose(f);
+    return -1;
+  }
 
-  if (freq1 < freq2) {
-    invalidate(e1);
+  int64_t added = 0;
+  alignas(64) char buf[kInternalPageSize]; // sizeof(InternalPage) is smaller
+  auto page = (InternalPage *)buf;
+  for (uint64_t i = 0; i < h.page_cnt; ++i) {
+    if (fread(buf, kInternalPageSize, 1, f) != 1) {
+      Debug::notifyError("%s is truncated", path);
+      added = -1;
+      break;
+    }
+    if (page->check_consistent() && add_to_cache(page)) {
+      added++;
+    }
+  }
+  fclose(f);
+  return added;
+}
+
+inline InternalPage *IndexCache::alloc_page() {
+  auto page = (InternalPage *)page_arena->alloc();
+  return page ? page : (InternalPage *)malloc(kInternalPageSize);
+}
+
+inline void IndexCache::free_page(InternalPage *page) {
+  if (page_arena->owns(page)) {
+    page_arena->free(page);
   } else {
-    invalidate(e2);
+    free(page);
   }
 }
 
 inline void IndexCache::statistics() {
-  printf("[skiplist node: %ld]  [page cache: %ld] [all page cache: %ld]\n", skiplist_node_cnt.load(),
-         all_page_cnt - free_page_cnt.load(), all_page_cnt);
+  int64_t used = 0;
+  for (int i = 1; i < kMaxLevel; ++i) {
+    used += occupancy(i);
+  }
+  printf("[skiplist node: %ld]  [page cache: %ld] [all page cache: %ld] "
+         "[epoch: %lu, retired: %lu] [arena: %lu / %lu]\n",
+         skiplist_node_cnt.load(), used, all_page_cnt, page_epoch.epoch(),
+         page_epoch.retired(), page_arena->used(), page_arena->capacity());
+  for (int i = 1; i < kMaxLevel; ++i) {
+    if (occupancy(i) != 0 || evictions(i) != 0) {
+      printf("  [level %d: %ld / %ld, evicted %lu]\n", i, occupancy(i),
+             level_page_cnt[i], evictions(i));
+    }
+  }
 }
 
 inline void IndexCache::bench() {
@@ -0,0 +1,301 @@
+#if !defined(_LEAF_CACHE_H_)
+#define _LEAF_CACHE_H_
+
+#include "HugePageAlloc.h"
+#include "Timer.h"
+#include "Tree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <city.h>
+#include <cstring>
+
+// copies of hot leaves in the compute node (optional, see enable_leaf_cache).
+// a leaf is admitted only if it is read more often than the one it would
+// replace (count-min sketch with aging, like TinyLFU). slots are 8-way set
+// associative and guarded by seqlocks, so lookups never block.
+// a cached record is served as is within the lease; otherwise the caller
+// reads back the record and the page version to validate it
+class LeafCache {
+public:
+  LeafCache(int cache_size, uint64_t lease_ns);
+
+  // slot of the record of k in the copy of leaf |addr|, -1 if none.
+  // value in *v, front version of the copy in *version, and whether
+  // the copy is within the lease in *fresh
+  int lookup(GlobalAddress addr, const Key &k, Value *v, uint8_t *version,
+             bool *fresh);
+  // record |index| of the copy was validated against the leaf
+  void refresh(GlobalAddress addr, int index, const Key &k, const Value &v);
+  // |page| was just read from |addr|
+  void access(GlobalAddress addr, const LeafPage *page);
+  void invalidate(GlobalAddress addr);
+
+  bool has_lease() const { return lease_ns != 0; }
+
+  // per app thread
+  struct Stat {
+    uint64_t hit;      // served within the lease
+    uint64_t validate; // served after a validation read
+    uint64_t miss;     // not cached or stale, whole leaf read
+  } __attribute__((aligned(define::kCacheLineSize)));
+
+  Stat &stat(int thread_id) { return stats[thread_id]; }
+  void clear_stat();
+  void statistics();
+
+private:
+  static const int kWays = 8;
+  static const int kSketchRows = 4;
+  static const uint8_t kMaxFreq = 15;
+  static const uint8_t kAdmitFreq = 2;
+
+  struct Slot {
+    std::atomic<uint64_t> seq; // odd while being written
+    uint64_t addr;             // GlobalAddress::Null(): empty
+    uint64_t load_time;        // ns, start of the lease
+    LeafPage page;
+  } __attribute__((aligned(define::kCacheLineSize)));
+
+  uint64_t lease_ns;
+  uint64_t set_cnt;
+  Slot *slots;
+
+  uint64_t sketch_mask;
+  std::atomic<uint8_t> *sketch[kSketchRows];
+  std::atomic<uint64_t> access_cnt;
+  uint64_t aging_period;
+
+  Stat *stats; // MAX_APP_THREAD
+
+  static uint64_t hash(GlobalAddress addr) {
+    return CityHash64((char *)&addr, sizeof(addr));
+  }
+  Slot *set_of(uint64_t h) { return slots + (h % set_cnt) * kWays; }
+  // double hashing over the rows
+  uint64_t counter_of(uint64_t h, int row) const {
+    return (h + row * ((h >> 32) | 1)) & sketch_mask;
+  }
+
+  uint8_t frequency(uint64_t h) const;
+  void increase(uint64_t h);
+  void age();
+
+  bool lock(Slot &s, uint64_t &seq);
+  void unlock(Slot &s, uint64_t seq) {
+    s.seq.store(seq + 2, std::memory_order_release);
+  }
+};
+
+inline LeafCache::LeafCache(int cache_size, uint64_t lease_ns)
+    : lease_ns(lease_ns), access_cnt(0) {
+  set_cnt = std::max<uint64_t>(
+      1, define::MB * cache_size / sizeof(Slot) / kWays);
+  slots = (Slot *)hugePageAlloc(set_cnt * kWays * sizeof(Slot));
+  memset((void *)slots, 0, set_cnt * kWays * sizeof(Slot));
+
+  // >= 4 counters per slot in each row
+  uint64_t sketch_cnt = 1;
+  while (sketch_cnt < set_cnt * kWays * 4) {
+    sketch_cnt *= 2;
+  }
+  sketch_mask = sketch_cnt - 1;
+  for (int i = 0; i < kSketchRows; ++i) {
+    sketch[i] = new std::atomic<uint8_t>[sketch_cnt];
+    for (uint64_t k = 0; k < sketch_cnt; ++k) {
+      sketch[i][k].store(0, std::memory_order_relaxed);
+    }
+  }
+  aging_period = sketch_cnt * 8;
+
+  stats = (Stat *)hugePageAlloc(sizeof(Stat) * MAX_APP_THREAD);
+  clear_stat();
+}
+
+inline uint8_t LeafCache::frequency(uint64_t h) const {
+  uint8_t f = kMaxFreq;
+  for (int i = 0; i < kSketchRows; ++i) {
+    auto c = sketch[i][counter_of(h, i)].load(std::memory_order_relaxed);
+    f = std::min(f, c);
+  }
+  return f;
+}
+
+// conservative update: only the smallest counters grow
+inline void LeafCache::increase(uint64_t h) {
+  uint8_t f = frequency(h);
+  if (f < kMaxFreq) {
+    for (int i = 0; i < kSketchRows; ++i) {
+      auto &c = sketch[i][counter_of(h, i)];
+      if (c.load(std::memory_order_relaxed) == f) {
+        c.store(f + 1, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  if (access_cnt.fetch_add(1, std::memory_order_relaxed) % aging_period ==
+      aging_period - 1) {
+    age();
+  }
+}
+
+// halve all counters, so that leaves which are not hot anymore can leave
+inline void LeafCache::age() {
+  for (int i = 0; i < kSketchRows; ++i) {
+    for (uint64_t k = 0; k <= sketch_mask; ++k) {
+      auto &c = sketch[i][k];
+      c.store(c.load(std::memory_order_relaxed) >> 1,
+              std::memory_order_relaxed);
+    }
+  }
+}
+
+// false if another thread is writing the slot
+inline bool LeafCache::lock(Slot &s, uint64_t &seq) {
+  seq = s.seq.load(std::memory_order_relaxed);
+  if ((seq & 1) ||
+      !s.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+inline int LeafCache::lookup(GlobalAddress addr, const Key &k, Value *v,
+                             uint8_t *version, bool *fresh) {
+  Slot *set = set_of(hash(addr));
+  for (int w = 0; w < kWays; ++w) {
+    auto &s = set[w];
+    uint64_t seq = s.seq.load(std::memory_order_acquire);
+    if ((seq & 1) || s.addr != addr.val) {
+      continue;
+    }
+
+    int index = -1;
+    if (k >= s.page.hdr.lowest && k < s.page.hdr.highest) {
+      index = s.page.find(k);
+    }
+    if (index != -1) {
+      *v = s.page.records[index].value;
+      *version = s.page.front_version;
+      *fresh = lease_ns != 0 && Timer::get_time_ns() - s.load_time < lease_ns;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) != seq) {
+      return -1;
+    }
+    return index;
+  }
+
+  return -1;
+}
+
+inline void LeafCache::refresh(GlobalAddress addr, int index, const Key &k,
+                               const Value &v) {
+  Slot *set = set_of(hash(addr));
+  for (int w = 0; w < kWays; ++w) {
+    auto &s = set[w];
+    uint64_t seq;
+    if (s.addr != addr.val || !lock(s, seq)) {
+      continue;
+    }
+    if (s.addr == addr.val && s.page.records[index].key == k) {
+      s.page.records[index].value = v;
+      s.load_time = lease_ns != 0 ? Timer::get_time_ns() : 0;
+    }
+    unlock(s, seq);
+    return;
+  }
+}
+
+inline void LeafCache::access(GlobalAddress addr, const LeafPage *page) {
+  uint64_t h = hash(addr);
+  increase(h);
+  uint8_t freq = frequency(h);
+  if (freq < kAdmitFreq) {
+    return;
+  }
+
+  // the copy of |addr|, an empty slot, or the least frequent leaf
+  Slot *set = set_of(h);
+  Slot *victim = nullptr;
+  uint8_t victim_freq = kMaxFreq + 1;
+  for (int w = 0; w < kWays; ++w) {
+    auto &s = set[w];
+    if (s.addr == addr.val) {
+      victim = &s;
+      victim_freq = 0;
+      break;
+    }
+    if (s.addr == GlobalAddress::Null().val) {
+      if (victim_freq != 0) {
+        victim = &s;
+        victim_freq = 0;
+      }
+      continue;
+    }
+    GlobalAddress other;
+    other.val = s.addr;
+    uint8_t f = frequency(hash(other));
+    if (f < victim_freq) {
+      victim = &s;
+      victim_freq = f;
+    }
+  }
+  if (victim_freq >= freq) {
+    return;
+  }
+
+  uint64_t seq;
+  if (!lock(*victim, seq)) {
+    return;
+  }
+  victim->addr = addr.val;
+  victim->load_time = lease_ns != 0 ? Timer::get_time_ns() : 0;
+  memcpy((void *)&victim->page, page, sizeof(LeafPage));
+  unlock(*victim, seq);
+}
+
+inline void LeafCache::invalidate(GlobalAddress addr) {
+  Slot *set = set_of(hash(addr));
+  for (int w = 0; w < kWays; ++w) {
+    auto &s = set[w];
+    uint64_t seq;
+    if (s.addr != addr.val || !lock(s, seq)) {
+      continue;
+    }
+    if (s.addr == addr.val) {
+      s.addr = GlobalAddress::Null().val;
+    }
+    unlock(s, seq);
+  }
+}
+
+inline void LeafCache::clear_stat() {
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    stats[i].hit = stats[i].validate = stats[i].miss = 0;
+  }
+}
+
+inline void LeafCache::statistics() {
+  uint64_t hit = 0, validate = 0, miss = 0;
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    hit += stats[i].hit;
+    validate += stats[i].validate;
+    miss += stats[i].miss;
+  }
+
+  uint64_t cached = 0;
+  for (uint64_t i = 0; i < set_cnt * kWays; ++i) {
+    cached += slots[i].addr != GlobalAddress::Null().val;
+  }
+
+  uint64_t all = std::max<uint64_t>(1, hit + validate + miss);
+  printf("leaf cache: %lu leaves, hit %lu (%.3f), validate %lu (%.3f), "
+         "miss %lu (%.3f)\n",
+         cached, hit, hit * 1.0 / all, validate, validate * 1.0 / all, miss,
+         miss * 1.0 / all);
+}
+
+#endif // _LEAF_CACHE_H_
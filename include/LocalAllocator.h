@@ -3,53 +3,205 @@
 
 #include "Common.h"
 #include "GlobalAddress.h"
+#include "Timer.h"
 
+#include <deque>
+#include <unordered_map>
 #include <vector>
 
 // for fine-grained shared memory alloc
 // not thread safe
-// now it is a simple log-structure alloctor
-// TODO: slab-based alloctor
+// slab-based: each chunk is carved into pages of one size by a bump pointer.
+// a freed page is kept by the thread which frees it and reused only after
+// kReuseDelay, since readers may still fetch it through a stale pointer;
+// reusable pages are grouped by memory node and handed out round-robin.
+// a chunk whose pages are all freed on one thread is given back to its
+// memory node (the caller sends it, see pop_empty_chunk()).
+// pages are asked for on a given memory node (see DSM placement), a size
+// class carves one chunk per node. chunks fetched ahead of time wait in a
+// reserve per node, a chunk which is used up is followed by one of them
 class LocalAllocator {
 
 public:
-  LocalAllocator() {
-    head = GlobalAddress::Null();
-    cur = GlobalAddress::Null();
-  }
+  static const uint64_t kReuseDelay = 100ull * 1000 * 1000; // ns
+
+  LocalAllocator() {}
+
+  // a page on |node|. need_chunck: there is no page of |size| left there,
+  // add_reserve() a chunk of |node| and retry
+  GlobalAddress malloc(size_t size, uint16_t node, bool &need_chunck) {
+    assert(node < MAX_MACHINE);
+    auto &c = size_class(size);
+    collect(c);
 
-  GlobalAddress malloc(size_t size, bool &need_chunck, bool align = false) {
+    need_chunck = false;
+    auto &r = c.ready[node];
+    if (!r.empty()) {
+      GlobalAddress res = r.back();
+      r.pop_back();
+
+      auto it = free_in_chunk.find(chunk_of(res).val);
+      if (--it->second == 0) {
+        free_in_chunk.erase(it);
+      }
+      return res;
+    }
 
-    if (align) {
+    auto &cur = c.cur[node];
+    if (cur == GlobalAddress::Null() || cur.offset + size > c.end[node]) {
+      if (reserve[node].empty()) {
+        need_chunck = true;
+        return GlobalAddress::Null();
+      }
+      set_chunck(reserve[node].front(), size);
+      reserve[node].pop_front();
     }
 
     GlobalAddress res = cur;
-    if (log_heads.empty() ||
-        (cur.offset + size > head.offset + define::kChunkSize)) {
-      need_chunck = true;
-    } else {
-      need_chunck = false;
-      cur.offset += size;
+    cur.offset += size;
+    return res;
+  }
+
+  // a node with freed pages of |size| ready for reuse, -1 if none
+  int reusable_node(size_t size) {
+    auto &c = size_class(size);
+    collect(c);
+    for (int i = 0; i < MAX_MACHINE; ++i) {
+      if (!c.ready[i].empty()) {
+        return i;
+      }
     }
+    return -1;
+  }
 
-    // assert(res.addr + size <= 40 * define::GB);
+  void add_reserve(const GlobalAddress &chunk) {
+    assert(chunk.offset % define::kChunkSize == 0);
+    reserve[chunk.nodeID].push_back(chunk);
+  }
 
-    return res;
+  bool has_reserve(uint16_t node) const { return !reserve[node].empty(); }
+
+  // a chunk carved on |node| is 3/4 used, time to fetch the one after it
+  bool chunk_low(uint16_t node) const {
+    for (auto &c : classes) {
+      uint64_t capacity = define::kChunkSize / c.size * c.size;
+      if (c.cur[node] != GlobalAddress::Null() &&
+          (c.end[node] - c.cur[node].offset) * 4 <= capacity) {
+        return true;
+      }
+    }
+    return false;
   }
 
-  void set_chunck(GlobalAddress &addr) {
-    log_heads.push_back(addr);
-    head = cur = addr;
+  void free(const GlobalAddress &addr, size_t size) {
+    auto &c = size_class(size);
+    c.pending.push_back({addr, Timer::get_time_ns()});
+    collect(c);
   }
 
-  void free(const GlobalAddress &addr) {
-    // TODO
+  // a chunk with no page in use, for DSM::free_chunk()
+  bool pop_empty_chunk(GlobalAddress &chunk) {
+    if (empty_chunks.empty()) {
+      return false;
+    }
+    chunk = empty_chunks.back();
+    empty_chunks.pop_back();
+    return true;
+  }
+
+  // freed pages kept by this thread, reusable or not
+  uint64_t free_pages() const {
+    uint64_t sum = 0;
+    for (auto &c : classes) {
+      sum += c.pending.size();
+      for (int i = 0; i < MAX_MACHINE; ++i) {
+        sum += c.ready[i].size();
+      }
+    }
+    return sum;
   }
 
 private:
-  GlobalAddress head;
-  GlobalAddress cur;
-  std::vector<GlobalAddress> log_heads;
+  struct Freed {
+    GlobalAddress addr;
+    uint64_t time;
+  };
+
+  struct SizeClass {
+    size_t size;
+    GlobalAddress cur[MAX_MACHINE]; // bump pointers in the current chunks
+    uint64_t end[MAX_MACHINE];
+    std::deque<Freed> pending; // in free order, not reusable yet
+    std::vector<GlobalAddress> ready[MAX_MACHINE]; // by memory node
+
+    SizeClass(size_t size) : size(size) {
+      for (int i = 0; i < MAX_MACHINE; ++i) {
+        cur[i] = GlobalAddress::Null();
+        end[i] = 0;
+      }
+    }
+  };
+
+  std::vector<SizeClass> classes; // a few sizes, searched linearly
+  std::deque<GlobalAddress> reserve[MAX_MACHINE];
+  std::unordered_map<uint64_t, uint32_t> free_in_chunk; // reusable pages
+  std::vector<GlobalAddress> empty_chunks;
+
+  static GlobalAddress chunk_of(GlobalAddress addr) {
+    addr.offset -= addr.offset % define::kChunkSize;
+    return addr;
+  }
+
+  void set_chunck(const GlobalAddress &chunk, size_t size) {
+    auto &c = size_class(size);
+    c.cur[chunk.nodeID] = chunk;
+    c.end[chunk.nodeID] = chunk.offset + define::kChunkSize / size * size;
+  }
+
+  SizeClass &size_class(size_t size) {
+    for (auto &c : classes) {
+      if (c.size == size) {
+        return c;
+      }
+    }
+    assert(size <= define::kChunkSize);
+    classes.emplace_back(size);
+    return classes.back();
+  }
+
+  // pages freed more than kReuseDelay ago become reusable
+  void collect(SizeClass &c) {
+    uint64_t now = Timer::get_time_ns();
+    while (!c.pending.empty() && c.pending.front().time + kReuseDelay <= now) {
+      GlobalAddress addr = c.pending.front().addr;
+      c.pending.pop_front();
+      c.ready[addr.nodeID].push_back(addr);
+
+      GlobalAddress chunk = chunk_of(addr);
+      auto &cur = c.cur[chunk.nodeID];
+      bool carving = // new pages are still cut from it
+          chunk_of(cur) == chunk && cur.offset + c.size <= c.end[chunk.nodeID];
+      if (++free_in_chunk[chunk.val] == define::kChunkSize / c.size &&
+          !carving) {
+        release(c, chunk);
+      }
+    }
+  }
+
+  // every page of |chunk| is reusable here, take them out of the slab
+  void release(SizeClass &c, GlobalAddress chunk) {
+    auto &r = c.ready[chunk.nodeID];
+    size_t n = 0;
+    for (size_t i = 0; i < r.size(); ++i) {
+      if (chunk_of(r[i]) != chunk) {
+        r[n++] = r[i];
+      }
+    }
+    r.resize(n);
+
+    free_in_chunk.erase(chunk.val);
+    empty_chunks.push_back(chunk);
+  }
 };
 
 #endif // _LOCAL_ALLOC_H_
@@ -0,0 +1,98 @@
+#if !defined(_METRICS_H_)
+#define _METRICS_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "Common.h"
+
+// counts and bytes of the DSM verbs posted by one app thread.
+// only the owner thread writes its block, so recording is two plain adds
+// on a private cache line; readers snapshot any block at any time and may
+// see it a few verbs behind
+class DSMMetrics {
+public:
+  enum Verb {
+    kRead,
+    kWrite,
+    kCas,
+    kCasMask,
+    kFaa,
+    kReadDM, // on-chip memory
+    kWriteDM,
+    kCasDM,
+    kCasMaskDM,
+    kFaaDM,
+    kReadBatch, // one post
+    kWriteBatch,
+    kWriteFaa,
+    kWriteCas,
+    kCasRead,
+    kMallocRpc,   // bytes of the chunks given
+    kMallocStall, // alloc() waited for chunks
+    kVerbCount
+  };
+
+  DSMMetrics() { clear(); }
+
+  void record(Verb v, uint64_t size) {
+    cnt[v]++;
+    byte[v] += size;
+  }
+
+  uint64_t count(Verb v) const { return cnt[v]; }
+  uint64_t bytes(Verb v) const { return byte[v]; }
+
+  uint64_t total_count() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < kVerbCount; ++i) {
+      sum += cnt[i];
+    }
+    return sum;
+  }
+
+  uint64_t total_bytes() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < kVerbCount; ++i) {
+      sum += byte[i];
+    }
+    return sum;
+  }
+
+  void merge(const DSMMetrics &other) {
+    for (int i = 0; i < kVerbCount; ++i) {
+      cnt[i] += other.cnt[i];
+      byte[i] += other.byte[i];
+    }
+  }
+
+  void clear() {
+    memset(cnt, 0, sizeof(cnt));
+    memset(byte, 0, sizeof(byte));
+  }
+
+  // verbs which were used
+  void print() const {
+    for (int i = 0; i < kVerbCount; ++i) {
+      if (cnt[i] != 0) {
+        printf("%-14s cnt %-12lu bytes %lu\n", name((Verb)i), cnt[i], byte[i]);
+      }
+    }
+  }
+
+  static const char *name(Verb v) {
+    static const char *names[kVerbCount] = {
+        "read",     "write",       "cas",        "cas_mask",  "faa",
+        "read_dm",  "write_dm",    "cas_dm",     "cas_mask_dm", "faa_dm",
+        "read_batch", "write_batch", "write_faa", "write_cas", "cas_read",
+        "malloc_rpc", "malloc_stall"};
+    return names[v];
+  }
+
+private:
+  uint64_t cnt[kVerbCount];
+  uint64_t byte[kVerbCount];
+} __attribute__((aligned(define::kCacheLineSize)));
+
+#endif // _METRICS_H_
@@ -0,0 +1,129 @@
+#if !defined(_PAGE_ARENA_H_)
+#define _PAGE_ARENA_H_
+
+#include "Common.h"
+#include "Debug.h"
+#include "Epoch.h"
+#include "HugePageAlloc.h"
+
+#include <atomic>
+#include <vector>
+
+// fixed-size blocks carved from one hugepage region of a fixed capacity.
+// a thread frees into and allocates from its own cache of blocks; a full
+// cache spills into a shared lock-free stack (head tagged against ABA),
+// an empty one takes from the stack, then from the never used blocks.
+// when all blocks are taken alloc() returns nullptr, the caller falls back
+// to malloc() and tells the blocks apart with owns()
+class PageArena {
+public:
+  static const size_t kThreadCache = 64; // blocks
+
+  PageArena(size_t block_size, uint64_t block_cnt);
+
+  void *alloc();
+  void free(void *p);
+
+  bool owns(const void *p) const {
+    return (const char *)p >= base &&
+           (const char *)p < base + block_size * block_cnt;
+  }
+
+  uint64_t capacity() const { return block_cnt; }
+  uint64_t used() const { return used_cnt.load(); }
+
+private:
+  static const uint32_t kNil = UINT32_MAX;
+
+  size_t block_size;
+  uint64_t block_cnt;
+  char *base;
+
+  std::atomic<uint64_t> fill_cnt; // blocks handed out at least once
+  std::atomic<uint64_t> used_cnt;
+  std::atomic<uint64_t> head; // tag << 32 | index of the top block
+
+  // per Epoch::thread_id(), owner only
+  std::vector<uint32_t> cache[Epoch::kMaxThread];
+
+  char *block(uint32_t i) const { return base + block_size * i; }
+  uint32_t index(const void *p) const {
+    return ((const char *)p - base) / block_size;
+  }
+  // the stack links blocks through their first bytes
+  std::atomic<uint32_t> &next(uint32_t i) const {
+    return *(std::atomic<uint32_t> *)block(i);
+  }
+
+  void push(uint32_t i);
+  uint32_t pop();
+};
+
+inline PageArena::PageArena(size_t block_size, uint64_t block_cnt)
+    : block_size(block_size), block_cnt(block_cnt), fill_cnt(0), used_cnt(0),
+      head(kNil) {
+  assert(block_size >= sizeof(uint32_t) && block_cnt < kNil);
+  base = (char *)hugePageAlloc(block_size * block_cnt);
+}
+
+inline void PageArena::push(uint32_t i) {
+  uint64_t h = head.load(std::memory_order_relaxed);
+  while (true) {
+    next(i).store(h & kNil, std::memory_order_relaxed);
+    uint64_t new_h = ((h >> 32) + 1) << 32 | i;
+    if (head.compare_exchange_weak(h, new_h, std::memory_order_release)) {
+      return;
+    }
+  }
+}
+
+// a popped block may be reused while another thread reads its link,
+// the tag makes that thread's CAS fail
+inline uint32_t PageArena::pop() {
+  uint64_t h = head.load(std::memory_order_acquire);
+  while (true) {
+    uint32_t i = h & kNil;
+    if (i == kNil) {
+      return kNil;
+    }
+    uint64_t new_h = ((h >> 32) + 1) << 32 | next(i).load();
+    if (head.compare_exchange_weak(h, new_h, std::memory_order_acquire)) {
+      return i;
+    }
+  }
+}
+
+inline void *PageArena::alloc() {
+  auto &c = cache[Epoch::thread_id()];
+  uint32_t i;
+  if (!c.empty()) {
+    i = c.back();
+    c.pop_back();
+  } else if ((i = pop()) == kNil) {
+    if (fill_cnt.load(std::memory_order_relaxed) >= block_cnt) {
+      return nullptr;
+    }
+    uint64_t f = fill_cnt.fetch_add(1);
+    if (f >= block_cnt) {
+      return nullptr;
+    }
+    i = f;
+  }
+
+  used_cnt.fetch_add(1, std::memory_order_relaxed);
+  return block(i);
+}
+
+inline void PageArena::free(void *p) {
+  assert(owns(p));
+  used_cnt.fetch_sub(1, std::memory_order_relaxed);
+
+  auto &c = cache[Epoch::thread_id()];
+  if (c.size() < kThreadCache) {
+    c.push_back(index(p));
+  } else {
+    push(index(p));
+  }
+}
+
+#endif // _PAGE_ARENA_H_
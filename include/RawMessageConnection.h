@@ -10,6 +10,7 @@ enum RpcType : uint8_t {
   MALLOC,
   FREE,
   NEW_ROOT,
+  ALLOC_STAT, // chunks used by a directory
   NOP,
 };
 
@@ -19,10 +20,18 @@ struct RawMessage {
   uint16_t node_id;
   uint16_t app_id;
 
-  GlobalAddress addr; // for malloc
+  GlobalAddress addr; // for free
   int level;
+
+  uint64_t used_chunks; // for alloc stat and malloc
+  uint64_t total_chunks;
+
+  uint8_t chunk_cnt; // for malloc, asked and then given
+  GlobalAddress chunks[define::kChunksPerMalloc];
 } __attribute__((packed));
 
+static_assert(sizeof(RawMessage) <= MESSAGE_SIZE, "RawMessage is too large");
+
 class RawMessageConnection : public AbstractMessageConnection {
 
 public:
@@ -20,6 +20,7 @@
 #define PSN 3185
 
 constexpr int kOroMax = 3;
+constexpr int kReadBatchMax = 32; // READs chained in one post
 struct RdmaOpRegion {
   uint64_t source;
   uint64_t dest;
@@ -132,6 +133,8 @@ void checkDMSupported(struct ibv_context *ctx);
 //// specified
 bool rdmaWriteBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
                     uint64_t wrID = 0);
+bool rdmaReadBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
+                   uint64_t wrID = 0);
 bool rdmaCasRead(ibv_qp *qp, const RdmaOpRegion &cas_ror,
                  const RdmaOpRegion &read_ror, uint64_t compare, uint64_t swap,
                  bool isSignaled, uint64_t wrID = 0);
@@ -0,0 +1,59 @@
+#if !defined(_SEARCH_KERNEL_H_)
+#define _SEARCH_KERNEL_H_
+
+#include "Common.h"
+
+#include <emmintrin.h>
+
+// one-byte fingerprint of a key, filters leaf records before key compares
+inline uint8_t key_fingerprint(const Key &k) {
+  return (k * 0x9E3779B97F4A7C15ull) >> 56;
+}
+
+// bit i is set iff fps[i] == fp (i < n <= 64).
+// SSE2 (always there on x86-64), 16 fingerprints per compare;
+// reads up to 15 bytes past fps[n - 1]
+inline uint64_t fingerprint_match(const uint8_t *fps, int n, uint8_t fp) {
+  const __m128i target = _mm_set1_epi8(fp);
+
+  uint64_t mask = 0;
+  for (int i = 0; i < n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(fps + i));
+    uint64_t m = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, target));
+    mask |= m << i;
+  }
+
+  return n == 64 ? mask : mask & ((1ull << n) - 1);
+}
+
+// keys of a packed page may sit at any offset
+typedef Key UnalignedKey __attribute__((aligned(1)));
+
+// number of keys in keys[0, n) not greater than k, keys sorted ascending;
+// i.e. the child slot of an internal page covering k
+// (0 for leftmost_ptr, i for ptrs[i - 1])
+using KeyRankFn = int (*)(const UnalignedKey *keys, int n, Key k);
+
+// picked once at startup from the CPU features (SearchKernel.cpp)
+extern const KeyRankFn key_rank_kernel;
+
+inline int key_rank(const UnalignedKey *keys, int n, const Key &k) {
+  return key_rank_kernel(keys, n, k);
+}
+
+// scalar fallback, binary search
+inline int key_rank_scalar(const UnalignedKey *keys, int n, Key k) {
+  int lo = 0;
+  int hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (keys[mid] <= k) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+#endif // _SEARCH_KERNEL_H_
@@ -17,7 +17,7 @@ struct ThreadConnection {
 
   RawMessageConnection *message;
 
-  ibv_qp **data[NR_DIRECTORY];
+  ibv_qp **data[MAX_DIRECTORY];
 
   ibv_mr *cacheMR;
   void *cachePool;
@@ -25,7 +25,8 @@ struct ThreadConnection {
   RemoteConnection *remoteInfo;
 
   ThreadConnection(uint16_t threadID, void *cachePool, uint64_t cacheSize,
-                   uint32_t machineNR, RemoteConnection *remoteInfo);
+                   uint32_t machineNR, uint32_t dirNR,
+                   RemoteConnection *remoteInfo);
 
   void sendMessage2Dir(RawMessage *m, uint16_t node_id, uint16_t dir_id = 0);
 };
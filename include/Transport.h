@@ -0,0 +1,113 @@
+#if !defined(_TRANSPORT_H_)
+#define _TRANSPORT_H_
+
+#include "Common.h"
+#include "RawMessageConnection.h"
+
+struct ThreadConnection;
+
+// the verbs an app thread can issue to memory nodes.
+// DSM translates global addresses into remote addresses/rkeys,
+// a transport only decides how the verbs are carried out.
+// one transport per app thread, not thread safe
+class Transport {
+public:
+  Transport() : cacheLKey(0) {}
+  virtual ~Transport() {}
+
+  uint32_t cacheLKey; // lkey of the local (registered) cache
+
+  virtual bool read(uint16_t node_id, uint64_t source, uint64_t dest,
+                    uint64_t size, uint32_t remoteRKey, bool signal = true,
+                    uint64_t wrID = 0) = 0;
+  virtual bool write(uint16_t node_id, uint64_t source, uint64_t dest,
+                     uint64_t size, uint32_t remoteRKey, bool signal = true,
+                     uint64_t wrID = 0) = 0;
+
+  virtual bool cas(uint16_t node_id, uint64_t source, uint64_t dest,
+                   uint64_t compare, uint64_t swap, uint32_t remoteRKey,
+                   bool signal = true, uint64_t wrID = 0) = 0;
+  virtual bool cas_mask(uint16_t node_id, uint64_t source, uint64_t dest,
+                        uint64_t compare, uint64_t swap, uint32_t remoteRKey,
+                        uint64_t mask = ~(0ull), bool signal = true) = 0;
+  virtual bool faa_boundary(uint16_t node_id, uint64_t source, uint64_t dest,
+                            uint64_t add, uint32_t remoteRKey,
+                            uint64_t boundary = 63, bool signal = true,
+                            uint64_t wrID = 0) = 0;
+
+  // chained verbs to the same node, only the last one is signaled
+  virtual bool write_batch(uint16_t node_id, RdmaOpRegion *ror, int k,
+                           bool signal, uint64_t wrID = 0) = 0;
+  virtual bool read_batch(uint16_t node_id, RdmaOpRegion *ror, int k,
+                          bool signal, uint64_t wrID = 0) = 0;
+  virtual bool cas_read(uint16_t node_id, const RdmaOpRegion &cas_ror,
+                        const RdmaOpRegion &read_ror, uint64_t compare,
+                        uint64_t swap, bool signal, uint64_t wrID = 0) = 0;
+  virtual bool write_faa(uint16_t node_id, const RdmaOpRegion &write_ror,
+                         const RdmaOpRegion &faa_ror, uint64_t add_val,
+                         bool signal, uint64_t wrID = 0) = 0;
+  virtual bool write_cas(uint16_t node_id, const RdmaOpRegion &write_ror,
+                         const RdmaOpRegion &cas_ror, uint64_t compare,
+                         uint64_t swap, bool signal, uint64_t wrID = 0) = 0;
+
+  // block until |count| signaled verbs complete, return the last wr_id
+  virtual uint64_t poll_cq(int count = 1) = 0;
+  virtual bool poll_cq_once(uint64_t &wr_id) = 0;
+
+  // two-sided messages to directory threads of memory nodes
+  virtual void rpc_call_dir(const RawMessage &m, uint16_t node_id,
+                            uint16_t dir_id = 0) = 0;
+  virtual RawMessage *rpc_wait() = 0;
+  // the reply if one has arrived, nullptr otherwise
+  virtual RawMessage *rpc_poll() = 0;
+};
+
+// RC queue pairs and CQs of RNICs
+class RdmaTransport : public Transport {
+public:
+  RdmaTransport(ThreadConnection *iCon);
+
+  bool read(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t size,
+            uint32_t remoteRKey, bool signal = true,
+            uint64_t wrID = 0) override;
+  bool write(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t size,
+             uint32_t remoteRKey, bool signal = true,
+             uint64_t wrID = 0) override;
+
+  bool cas(uint16_t node_id, uint64_t source, uint64_t dest, uint64_t compare,
+           uint64_t swap, uint32_t remoteRKey, bool signal = true,
+           uint64_t wrID = 0) override;
+  bool cas_mask(uint16_t node_id, uint64_t source, uint64_t dest,
+                uint64_t compare, uint64_t swap, uint32_t remoteRKey,
+                uint64_t mask = ~(0ull), bool signal = true) override;
+  bool faa_boundary(uint16_t node_id, uint64_t source, uint64_t dest,
+                    uint64_t add, uint32_t remoteRKey, uint64_t boundary = 63,
+                    bool signal = true, uint64_t wrID = 0) override;
+
+  bool write_batch(uint16_t node_id, RdmaOpRegion *ror, int k, bool signal,
+                   uint64_t wrID = 0) override;
+  bool read_batch(uint16_t node_id, RdmaOpRegion *ror, int k, bool signal,
+                  uint64_t wrID = 0) override;
+  bool cas_read(uint16_t node_id, const RdmaOpRegion &cas_ror,
+                const RdmaOpRegion &read_ror, uint64_t compare, uint64_t swap,
+                bool signal, uint64_t wrID = 0) override;
+  bool write_faa(uint16_t node_id, const RdmaOpRegion &write_ror,
+                 const RdmaOpRegion &faa_ror, uint64_t add_val, bool signal,
+                 uint64_t wrID = 0) override;
+  bool write_cas(uint16_t node_id, const RdmaOpRegion &write_ror,
+                 const RdmaOpRegion &cas_ror, uint64_t compare, uint64_t swap,
+                 bool signal, uint64_t wrID = 0) override;
+
+  uint64_t poll_cq(int count = 1) override;
+  bool poll_cq_once(uint64_t &wr_id) override;
+
+  void rpc_call_dir(const RawMessage &m, uint16_t node_id,
+                    uint16_t dir_id = 0) override;
+  RawMessage *rpc_wait() override;
+  RawMessage *rpc_poll() override;
+
+private:
+  ThreadConnection *iCon;
+};
+
+#endif // _TRANSPORT_H_
@@ -2,12 +2,18 @@
 #define _TREE_H_
 
 #include "DSM.h"
+#include "SearchKernel.h"
 #include <atomic>
 #include <city.h>
 #include <functional>
 #include <iostream>
+#include <vector>
 
 class IndexCache;
+class LeafCache;
+class LeafPage;
+struct CacheEntry;
+struct WarmUp;
 
 struct LocalLockNode {
   std::atomic<uint64_t> ticket_lock;
@@ -29,12 +35,28 @@ public:
 
 using CoroFunc = std::function<RequstGen *(int, DSM *, int)>;
 
+// yield the next pair of a sorted stream, false at the end
+using KVStream = std::function<bool(Key &, Value &)>;
+
 struct SearchResult {
   bool is_leaf;
   uint8_t level;
   GlobalAddress slibing;
   GlobalAddress next_level;
   Value val;
+  const LeafPage *leaf; // in the rdma buffer, until the next page read
+};
+
+// progress of a scan over [next, to]
+struct ScanState {
+  Key next; // keys smaller than it are scanned
+  Key to;
+  bool done;
+  bool prefetched;
+  char next_parent[kInternalPageSize]; // prefetched level-1 page
+
+  ScanState(const Key &from, const Key &to)
+      : next(from), to(to), done(false), prefetched(false) {}
 };
 
 class InternalPage;
@@ -46,20 +68,41 @@ public:
 
   void insert(const Key &k, const Value &v, CoroContext *cxt = nullptr,
               int coro_id = 0);
+  void insert_batch(const Key *keys, const Value *values, int n,
+                    CoroContext *cxt = nullptr, int coro_id = 0);
   bool search(const Key &k, Value &v, CoroContext *cxt = nullptr,
               int coro_id = 0);
+  int search_batch(const Key *keys, Value *values, bool *found, int n,
+                   CoroContext *cxt = nullptr, int coro_id = 0);
   void del(const Key &k, CoroContext *cxt = nullptr, int coro_id = 0);
 
   uint64_t range_query(const Key &from, const Key &to, Value *buffer,
                        CoroContext *cxt = nullptr, int coro_id = 0);
 
+  bool bulk_load(const KVStream &next, double fill_factor = 0.8);
+
   void print_and_check_tree(CoroContext *cxt = nullptr, int coro_id = 0);
 
   void run_coroutine(CoroFunc func, int id, int coro_cnt);
 
   void lock_bench(const Key &k, CoroContext *cxt = nullptr, int coro_id = 0);
 
+  // warm restart: save the index cache to a file and load it back
+  bool save_index_cache(const char *path);
+  int64_t load_index_cache(const char *path);
+  // read back the cached pages in batches and replace those which changed,
+  // e.g. on a background thread after a load; the count of stale pages
+  uint64_t revalidate_index_cache(CoroContext *cxt = nullptr,
+                                  int coro_id = 0);
+  // fill the index cache without waiting for misses (after a restart or
+  // many splits), e.g. on a background thread: walk the internal levels
+  // from the root with batched reads on |coro_cnt| coroutines of this
+  // thread, until the budget of each level is used, reading at most
+  // |mb_per_sec| MB/s (0: no limit). the count of pages cached
+  uint64_t warm_up_index_cache(int coro_cnt = 4, double mb_per_sec = 0);
+
   void index_cache_statistics();
+  void leaf_cache_statistics();
   void clear_statistics();
 
 private:
@@ -74,6 +117,7 @@ private:
   LocalLockNode *local_locks[MAX_MACHINE];
 
   IndexCache *index_cache;
+  LeafCache *leaf_cache; // nullptr if disabled
 
   void print_verbose();
 
@@ -81,9 +125,15 @@ private:
 
   GlobalAddress get_root_ptr_ptr();
   GlobalAddress get_root_ptr(CoroContext *cxt, int coro_id);
+  GlobalAddress traversal_start(const Key &k, GlobalAddress root,
+                                const CacheEntry **entry);
+  bool leaf_cache_search(GlobalAddress leaf, const Key &k, Value &v,
+                         CoroContext *cxt, int coro_id);
 
   void coro_worker(CoroYield &yield, RequstGen *gen, int coro_id);
   void coro_master(CoroYield &yield, int coro_cnt);
+  void warm_up_worker(CoroYield &yield, WarmUp *w, int coro_id);
+  void warm_up_master(CoroYield &yield, WarmUp *w, int coro_cnt);
 
   void broadcast_new_root(GlobalAddress new_root_addr, int root_level);
   bool update_new_root(GlobalAddress left, const Key &k, GlobalAddress right,
@@ -95,12 +145,18 @@ private:
 
   bool try_lock_addr(GlobalAddress lock_addr, uint64_t tag, uint64_t *buf,
                      CoroContext *cxt, int coro_id);
+  void spin_lock_addr(GlobalAddress lock_addr, uint64_t tag, uint64_t *buf,
+                      CoroContext *cxt);
   void unlock_addr(GlobalAddress lock_addr, uint64_t tag, uint64_t *buf,
                    CoroContext *cxt, int coro_id, bool async);
   void write_page_and_unlock(char *page_buffer, GlobalAddress page_addr,
                              int page_size, uint64_t *cas_buffer,
                              GlobalAddress lock_addr, uint64_t tag,
                              CoroContext *cxt, int coro_id, bool async);
+  void write_leaf_and_unlock(LeafPage *page, int lo, int hi,
+                             GlobalAddress page_addr, uint64_t *cas_buffer,
+                             GlobalAddress lock_addr, uint64_t tag,
+                             CoroContext *cxt, int coro_id);
   void lock_and_read_page(char *page_buffer, GlobalAddress page_addr,
                           int page_size, uint64_t *cas_buffer,
                           GlobalAddress lock_addr, uint64_t tag,
@@ -110,6 +166,11 @@ private:
                    CoroContext *cxt, int coro_id, bool from_cache = false);
   void internal_page_search(InternalPage *page, const Key &k,
                             SearchResult &result);
+  bool read_level1_page(const Key &k, char *buffer, GlobalAddress &leaf_addr,
+                        CoroContext *cxt, int coro_id);
+  template <class F>
+  void scan_level1_page(ScanState &st, F &&emit, CoroContext *cxt,
+                        int coro_id);
   void leaf_page_search(LeafPage *page, const Key &k, SearchResult &result);
 
   void internal_page_store(GlobalAddress page_addr, const Key &k,
@@ -118,6 +179,14 @@ private:
   bool leaf_page_store(GlobalAddress page_addr, const Key &k, const Value &v,
                        GlobalAddress root, int level, CoroContext *cxt,
                        int coro_id, bool from_cache = false);
+  int leaf_page_store_batch(GlobalAddress page_addr, const Key *keys,
+                            const Value *values, const int *idx, int cnt,
+                            GlobalAddress root, int level, CoroContext *cxt,
+                            int coro_id, bool from_cache = false);
+  void leaf_page_split(LeafPage *page, GlobalAddress page_addr, int cnt,
+                       GlobalAddress root, int level, uint64_t *cas_buffer,
+                       GlobalAddress lock_addr, uint64_t tag,
+                       CoroContext *cxt, int coro_id, bool from_cache);
   bool leaf_page_del(GlobalAddress page_addr, const Key &k, int level,
                      CoroContext *cxt, int coro_id, bool from_cache = false);
 
@@ -125,6 +194,35 @@ private:
                           int coro_id);
   bool can_hand_over(GlobalAddress lock_addr);
   void releases_local_lock(GlobalAddress lock_addr);
+
+  friend class ScanCursor;
+};
+
+// scan [from, to] in pages of sorted (key, value) pairs, in constant memory:
+// leaves are read in batches of one level-1 page, while the following
+// level-1 page is prefetched. the cursor keeps nothing in registered
+// memory, so other operations may run between next() calls. a new cursor
+// from resume_key() continues an interrupted scan
+class ScanCursor {
+public:
+  ScanCursor(Tree *tree, const Key &from, const Key &to,
+             CoroContext *cxt = nullptr, int coro_id = 0);
+
+  // up to |max_cnt| pairs following the previous call, 0 at the end
+  int next(Key *keys, Value *values, int max_cnt);
+
+  bool end() const { return st.done && pos == pending.size(); }
+  Key resume_key() const { return resume; }
+
+private:
+  Tree *tree;
+  CoroContext *cxt;
+  int coro_id;
+
+  ScanState st;
+  std::vector<std::pair<Key, Value>> pending; // fetched, not returned
+  size_t pos;
+  Key resume;
 };
 
 class Header {
@@ -140,6 +238,7 @@ private:
   friend class LeafPage;
   friend class Tree;
   friend class IndexCache;
+  friend class LeafCache;
 
 public:
   Header() {
@@ -160,17 +259,6 @@ public:
 } __attribute__((packed));
 ;
 
-class InternalEntry {
-public:
-  Key key;
-  GlobalAddress ptr;
-
-  InternalEntry() {
-    ptr = GlobalAddress::Null();
-    key = 0;
-  }
-} __attribute__((packed));
-
 class LeafEntry {
 public:
   uint8_t f_version : 4;
@@ -188,11 +276,17 @@ public:
 
 constexpr int kInternalCardinality = (kInternalPageSize - sizeof(Header) -
                                       sizeof(uint8_t) * 2 - sizeof(uint64_t)) /
-                                     sizeof(InternalEntry);
+                                     (sizeof(Key) + sizeof(GlobalAddress));
 
+#ifdef CONFIG_ENABLE_LEAF_FP
+constexpr int kLeafCardinality =
+    (kLeafPageSize - sizeof(Header) - sizeof(uint8_t) * 2 - sizeof(uint64_t)) /
+    (sizeof(LeafEntry) + sizeof(uint8_t));
+#else
 constexpr int kLeafCardinality =
     (kLeafPageSize - sizeof(Header) - sizeof(uint8_t) * 2 - sizeof(uint64_t)) /
     sizeof(LeafEntry);
+#endif
 
 class InternalPage {
 private:
@@ -204,12 +298,16 @@ private:
 
   uint8_t front_version;
   Header hdr;
-  InternalEntry records[kInternalCardinality];
+  // separator keys apart from child pointers, so that a lookup
+  // compares consecutive keys with SIMD (see key_rank)
+  Key keys[kInternalCardinality];
+  GlobalAddress ptrs[kInternalCardinality];
 
   // uint8_t padding[3];
   uint8_t rear_version;
 
   friend class Tree;
+  friend class LeafCache;
   friend class IndexCache;
 
 public:
@@ -218,9 +316,9 @@ public:
                uint32_t level = 0) {
     hdr.leftmost_ptr = left;
     hdr.level = level;
-    records[0].key = key;
-    records[0].ptr = right;
-    records[1].ptr = GlobalAddress::Null();
+    keys[0] = key;
+    ptrs[0] = right;
+    ptrs[1] = GlobalAddress::Null();
 
     hdr.last_index = 0;
 
@@ -230,7 +328,7 @@ public:
 
   InternalPage(uint32_t level = 0) {
     hdr.level = level;
-    records[0].ptr = GlobalAddress::Null();
+    ptrs[0] = GlobalAddress::Null();
 
     front_version = 0;
     rear_version = 0;
@@ -260,6 +358,18 @@ public:
     return succ;
   }
 
+  // fence keys, for pages built outside a tree (e.g. index_cache_bench)
+  void set_range(const Key &lowest, const Key &highest) {
+    hdr.lowest = lowest;
+    hdr.highest = highest;
+  }
+
+  // child whose range covers k (lowest <= k < highest)
+  GlobalAddress child(const Key &k) const {
+    int i = key_rank(keys, hdr.last_index + 1, k);
+    return i == 0 ? hdr.leftmost_ptr : ptrs[i - 1];
+  }
+
   void debug() const {
     std::cout << "InternalPage@ ";
     hdr.debug();
@@ -270,7 +380,7 @@ public:
   void verbose_debug() const {
     this->debug();
     for (int i = 0; i < this->hdr.last_index + 1; ++i) {
-      printf("[%lu %lu] ", this->records[i].key, this->records[i].ptr.val);
+      printf("[%lu %lu] ", this->keys[i], this->ptrs[i].val);
     }
     printf("\n");
   }
@@ -285,12 +395,16 @@ private:
   };
   uint8_t front_version;
   Header hdr;
+#ifdef CONFIG_ENABLE_LEAF_FP
+  uint8_t fp[kLeafCardinality]; // key_fingerprint of records
+#endif
   LeafEntry records[kLeafCardinality];
 
   // uint8_t padding[1];
   uint8_t rear_version;
 
   friend class Tree;
+  friend class LeafCache;
 
 public:
   LeafPage(uint32_t level = 0) {
@@ -301,6 +415,37 @@ public:
     rear_version = 0;
 
     embedding_lock = 0;
+#ifdef CONFIG_ENABLE_LEAF_FP
+    memset(fp, 0, sizeof(fp));
+#endif
+  }
+
+  // index of the (non-empty) record of |k|, -1 if none
+  int find(const Key &k) const {
+#ifdef CONFIG_ENABLE_LEAF_FP
+    auto mask = fingerprint_match(fp, kLeafCardinality, key_fingerprint(k));
+    while (mask) {
+      int i = __builtin_ctzll(mask);
+      if (records[i].key == k && records[i].value != kValueNull) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+#else
+    for (int i = 0; i < kLeafCardinality; ++i) {
+      if (records[i].key == k && records[i].value != kValueNull) {
+        return i;
+      }
+    }
+#endif
+    return -1;
+  }
+
+  // call after records[i].key is changed
+  void update_fp(int i) {
+#ifdef CONFIG_ENABLE_LEAF_FP
+    fp[i] = key_fingerprint(records[i].key);
+#endif
   }
 
   void set_consistent() {
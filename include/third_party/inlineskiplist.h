@@ -51,11 +51,33 @@
 
 #include <cerrno>
 #include <cstddef>
+
+#include "Debug.h"
+#include "HugePageAlloc.h"
+
+// nodes are never freed: bump allocation from hugepage chunks, each
+// thread from its own chunk
 class Allocator {
 public:
+  static const size_t kChunkSize = 2 * 1024 * 1024;
+
   char *Allocate(size_t bytes) { return AllocateAligned(bytes); }
   char *AllocateAligned(size_t bytes, size_t huge_page_size = 0) {
-    return (char *)aligned_alloc(8, bytes);
+    static thread_local char *chunk = nullptr;
+    static thread_local size_t left = 0;
+
+    bytes = (bytes + 7) & ~(size_t)7;
+    if (bytes > kChunkSize / 4) {
+      return (char *)aligned_alloc(8, bytes);
+    }
+    if (bytes > left) {
+      chunk = (char *)hugePageAlloc(kChunkSize);
+      left = kChunkSize;
+    }
+    char *res = chunk;
+    chunk += bytes;
+    left -= bytes;
+    return res;
   }
 };
 
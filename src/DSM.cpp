@@ -1,6 +1,7 @@
 
 #include "DSM.h"
 #include "Directory.h"
+#include "EmulatedTransport.h"
 #include "HugePageAlloc.h"
 
 #include "DSMKeeper.h"
@@ -9,16 +10,16 @@
 
 thread_local int DSM::thread_id = -1;
 thread_local ThreadConnection *DSM::iCon = nullptr;
+thread_local Transport *DSM::transport = nullptr;
 thread_local char *DSM::rdma_buffer = nullptr;
 thread_local LocalAllocator DSM::local_allocator;
+thread_local DSM::MallocState DSM::malloc_state;
 thread_local RdmaBuffer DSM::rbuf[define::kMaxCoro];
 thread_local uint64_t DSM::thread_tag = 0;
+thread_local std::queue<uint16_t> hot_wait_queue;
 
-uint64_t read_cnt;
-uint64_t read_bytes;
-uint64_t write_cnt;
-uint64_t write_bytes;
-uint64_t cas_cnt;
+DSMMetrics DSM::metrics[MAX_APP_THREAD];
+LatencyHistogram DSM::malloc_latency[MAX_APP_THREAD];
 
 DSM *DSM::getInstance(const DSMConfig &conf) {
   static DSM *dsm = nullptr;
@@ -35,7 +36,14 @@ DSM *DSM::getInstance(const DSMConfig &conf) {
 }
 
 DSM::DSM(const DSMConfig &conf)
-    : conf(conf), appID(0), cache(conf.cacheConfig) {
+    : conf(conf), appID(0), cache(conf.cacheConfig), keeper(nullptr),
+      fabric(nullptr) {
+
+  assert(conf.dirNR >= 1 && conf.dirNR <= MAX_DIRECTORY);
+  if (conf.transport == TransportType::EMULATED) {
+    initEmulatedConnection();
+    return;
+  }
 
   baseAddr = (uint64_t)hugePageAlloc(conf.dsmSize * define::GB);
 
@@ -54,10 +62,10 @@ DSM::DSM(const DSMConfig &conf)
 
   initRDMAConnection();
 
-  Debug::notifyInfo("number of threads on memory node: %d", NR_DIRECTORY);
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
-    dirAgent[i] =
-        new Directory(dirCon[i], remoteInfo, conf.machineNR, i, myNodeID);
+  Debug::notifyInfo("number of threads on memory node: %d", conf.dirNR);
+  for (uint32_t i = 0; i < conf.dirNR; ++i) {
+    dirAgent[i] = new Directory(dirCon[i], remoteInfo, conf.machineNR, i,
+                                conf.dirNR, myNodeID);
   }
 
   keeper->barrier("DSM-init");
@@ -76,8 +84,9 @@ void DSM::registerThread() {
   thread_tag = thread_id + (((uint64_t)this->getMyNodeID()) << 32) + 1;
 
   iCon = thCon[thread_id];
+  transport = thTrans[thread_id];
 
-  if (!has_init[thread_id]) {
+  if (iCon && !has_init[thread_id]) {
     iCon->message->initRecv();
     iCon->message->initSend();
 
@@ -85,6 +94,10 @@ void DSM::registerThread() {
   }
 
   rdma_buffer = (char *)cache.data + thread_id * 12 * define::MB;
+  static_assert(define::kMaxCoro * define::kPerCoroRdmaBuf +
+                        define::kBulkRdmaBuf <=
+                    12 * define::MB,
+                "rdma buffer of a thread");
 
   for (int i = 0; i < define::kMaxCoro; ++i) {
     rbuf[i].set_buffer(rdma_buffer + i * define::kPerCoroRdmaBuf);
@@ -100,33 +113,63 @@ void DSM::initRDMAConnection() {
   for (int i = 0; i < MAX_APP_THREAD; ++i) {
     thCon[i] =
         new ThreadConnection(i, (void *)cache.data, cache.size * define::GB,
-                             conf.machineNR, remoteInfo);
+                             conf.machineNR, conf.dirNR, remoteInfo);
+    thTrans[i] = new RdmaTransport(thCon[i]);
   }
 
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < conf.dirNR; ++i) {
     dirCon[i] =
         new DirectoryConnection(i, (void *)baseAddr, conf.dsmSize * define::GB,
                                 conf.machineNR, remoteInfo);
   }
 
-  keeper = new DSMKeeper(thCon, dirCon, remoteInfo, conf.machineNR);
+  keeper =
+      new DSMKeeper(thCon, dirCon, remoteInfo, conf.machineNR, conf.dirNR);
 
   myNodeID = keeper->getMyNodeID();
 }
 
+// this process is the only compute node, and it hosts all memory nodes
+void DSM::initEmulatedConnection() {
+
+  Debug::notifyInfo("number of emulated memory nodes: %d", conf.machineNR);
+
+  fabric = new EmulatedFabric(conf.machineNR, conf.dsmSize * define::GB,
+                              conf.dirNR);
+
+  remoteInfo = new RemoteConnection[conf.machineNR];
+  for (uint32_t i = 0; i < conf.machineNR; ++i) {
+    memset(&remoteInfo[i], 0, sizeof(RemoteConnection));
+    remoteInfo[i].dsmBase = fabric->dsm_base(i);
+    remoteInfo[i].lockBase = fabric->lock_base(i);
+    remoteInfo[i].cacheBase = cache.data;
+  }
+
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    thCon[i] = nullptr;
+    thTrans[i] = new EmulatedTransport(fabric);
+  }
+
+  for (int i = 0; i < MAX_DIRECTORY; ++i) {
+    dirCon[i] = nullptr;
+    dirAgent[i] = nullptr;
+  }
+
+  baseAddr = fabric->dsm_base(0);
+  myNodeID = 0;
+}
+
 void DSM::read(char *buffer, GlobalAddress gaddr, size_t size, bool signal,
                CoroContext *ctx) {
-    read_cnt++;
-    read_bytes+=size;
+  metrics[thread_id].record(DSMMetrics::kRead, size);
   if (ctx == nullptr) {
-    rdmaRead(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-             remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
-             iCon->cacheLKey, remoteInfo[gaddr.nodeID].dsmRKey[0], signal);
+    transport->read(gaddr.nodeID, (uint64_t)buffer,
+                    remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
+                    remoteInfo[gaddr.nodeID].dsmRKey[0], signal);
   } else {
-    rdmaRead(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-             remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
-             iCon->cacheLKey, remoteInfo[gaddr.nodeID].dsmRKey[0], true,
-             ctx->coro_id);
+    transport->read(gaddr.nodeID, (uint64_t)buffer,
+                    remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
+                    remoteInfo[gaddr.nodeID].dsmRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -135,24 +178,21 @@ void DSM::read_sync(char *buffer, GlobalAddress gaddr, size_t size,
                     CoroContext *ctx) {
   read(buffer, gaddr, size, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::write(const char *buffer, GlobalAddress gaddr, size_t size,
                 bool signal, CoroContext *ctx) {
-    write_cnt++;
-    write_bytes+=size;
+  metrics[thread_id].record(DSMMetrics::kWrite, size);
   if (ctx == nullptr) {
-    rdmaWrite(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-              remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
-              iCon->cacheLKey, remoteInfo[gaddr.nodeID].dsmRKey[0], -1, signal);
+    transport->write(gaddr.nodeID, (uint64_t)buffer,
+                     remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
+                     remoteInfo[gaddr.nodeID].dsmRKey[0], signal);
   } else {
-    rdmaWrite(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-              remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
-              iCon->cacheLKey, remoteInfo[gaddr.nodeID].dsmRKey[0], -1, true,
-              ctx->coro_id);
+    transport->write(gaddr.nodeID, (uint64_t)buffer,
+                     remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, size,
+                     remoteInfo[gaddr.nodeID].dsmRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -161,13 +201,12 @@ void DSM::write_sync(const char *buffer, GlobalAddress gaddr, size_t size,
                      CoroContext *ctx) {
   write(buffer, gaddr, size, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::fill_keys_dest(RdmaOpRegion &ror, GlobalAddress gaddr, bool is_chip) {
-  ror.lkey = iCon->cacheLKey;
+  ror.lkey = transport->cacheLKey;
   if (is_chip) {
     ror.dest = remoteInfo[gaddr.nodeID].lockBase + gaddr.offset;
     ror.remoteRKey = remoteInfo[gaddr.nodeID].lockRKey[0];
@@ -178,7 +217,7 @@ void DSM::fill_keys_dest(RdmaOpRegion &ror, GlobalAddress gaddr, bool is_chip) {
 }
 
 void DSM::write_batch(RdmaOpRegion *rs, int k, bool signal, CoroContext *ctx) {
-  write_cnt++;
+  uint64_t size = 0;
   int node_id = -1;
   for (int i = 0; i < k; ++i) {
 
@@ -186,13 +225,14 @@ void DSM::write_batch(RdmaOpRegion *rs, int k, bool signal, CoroContext *ctx) {
     gaddr.val = rs[i].dest;
     node_id = gaddr.nodeID;
     fill_keys_dest(rs[i], gaddr, rs[i].is_on_chip);
-    write_bytes+=rs[i].size;
+    size += rs[i].size;
   }
+  metrics[thread_id].record(DSMMetrics::kWriteBatch, size);
 
   if (ctx == nullptr) {
-    rdmaWriteBatch(iCon->data[0][node_id], rs, k, signal);
+    transport->write_batch(node_id, rs, k, signal);
   } else {
-    rdmaWriteBatch(iCon->data[0][node_id], rs, k, true, ctx->coro_id);
+    transport->write_batch(node_id, rs, k, true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -201,15 +241,61 @@ void DSM::write_batch_sync(RdmaOpRegion *rs, int k, CoroContext *ctx) {
   write_batch(rs, k, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
+  }
+}
+
+// one post per node (per kReadBatchMax READs), all posts are in flight
+// together, so the batch costs about one round trip. READs of one node
+// keep their order in |rs|
+void DSM::read_batches_sync(RdmaOpRegion *rs, int k, CoroContext *ctx) {
+  auto node_of = [](const RdmaOpRegion &r) {
+    GlobalAddress gaddr;
+    gaddr.val = r.dest;
+    return gaddr.nodeID;
+  };
+  for (int i = 1; i < k; ++i) { // stable insertion sort, |rs| is short
+    auto r = rs[i];
+    int j = i - 1;
+    for (; j >= 0 && node_of(rs[j]) > node_of(r); --j) {
+      rs[j + 1] = rs[j];
+    }
+    rs[j + 1] = r;
+  }
+
+  int post_cnt = 0;
+  for (int i = 0; i < k;) {
+    auto node_id = node_of(rs[i]);
+
+    uint64_t size = 0;
+    int j = i;
+    for (; j < k && j - i < kReadBatchMax && node_of(rs[j]) == node_id; ++j) {
+      GlobalAddress gaddr;
+      gaddr.val = rs[j].dest;
+      fill_keys_dest(rs[j], gaddr, false);
+      size += rs[j].size;
+    }
+    metrics[thread_id].record(DSMMetrics::kReadBatch, size);
+
+    transport->read_batch(node_id, rs + i, j - i, true,
+                          ctx == nullptr ? 0 : ctx->coro_id);
+    post_cnt++;
+    i = j;
+  }
+
+  if (ctx == nullptr) {
+    transport->poll_cq(post_cnt);
+  } else {
+    for (int i = 0; i < post_cnt; ++i) { // resumed once per completion
+      (*ctx->yield)(*ctx->master);
+    }
   }
 }
 
 void DSM::write_faa(RdmaOpRegion &write_ror, RdmaOpRegion &faa_ror,
                     uint64_t add_val, bool signal, CoroContext *ctx) {
-    write_cnt++;
-    write_bytes = write_bytes + write_ror.size + faa_ror.size;
+  metrics[thread_id].record(DSMMetrics::kWriteFaa,
+                            write_ror.size + sizeof(uint64_t));
   int node_id;
   {
     GlobalAddress gaddr;
@@ -225,10 +311,10 @@ void DSM::write_faa(RdmaOpRegion &write_ror, RdmaOpRegion &faa_ror,
     fill_keys_dest(faa_ror, gaddr, faa_ror.is_on_chip);
   }
   if (ctx == nullptr) {
-    rdmaWriteFaa(iCon->data[0][node_id], write_ror, faa_ror, add_val, signal);
+    transport->write_faa(node_id, write_ror, faa_ror, add_val, signal);
   } else {
-    rdmaWriteFaa(iCon->data[0][node_id], write_ror, faa_ror, add_val, true,
-                 ctx->coro_id);
+    transport->write_faa(node_id, write_ror, faa_ror, add_val, true,
+                         ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -236,16 +322,15 @@ void DSM::write_faa_sync(RdmaOpRegion &write_ror, RdmaOpRegion &faa_ror,
                          uint64_t add_val, CoroContext *ctx) {
   write_faa(write_ror, faa_ror, add_val, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::write_cas(RdmaOpRegion &write_ror, RdmaOpRegion &cas_ror,
                     uint64_t equal, uint64_t val, bool signal,
                     CoroContext *ctx) {
-    write_cnt++;
-    write_bytes = write_bytes + write_ror.size + cas_ror.size;
+  metrics[thread_id].record(DSMMetrics::kWriteCas,
+                            write_ror.size + sizeof(uint64_t));
   int node_id;
   {
     GlobalAddress gaddr;
@@ -261,11 +346,10 @@ void DSM::write_cas(RdmaOpRegion &write_ror, RdmaOpRegion &cas_ror,
     fill_keys_dest(cas_ror, gaddr, cas_ror.is_on_chip);
   }
   if (ctx == nullptr) {
-    rdmaWriteCas(iCon->data[0][node_id], write_ror, cas_ror, equal, val,
-                 signal);
+    transport->write_cas(node_id, write_ror, cas_ror, equal, val, signal);
   } else {
-    rdmaWriteCas(iCon->data[0][node_id], write_ror, cas_ror, equal, val, true,
-                 ctx->coro_id);
+    transport->write_cas(node_id, write_ror, cas_ror, equal, val, true,
+                         ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -273,16 +357,15 @@ void DSM::write_cas_sync(RdmaOpRegion &write_ror, RdmaOpRegion &cas_ror,
                          uint64_t equal, uint64_t val, CoroContext *ctx) {
   write_cas(write_ror, cas_ror, equal, val, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::cas_read(RdmaOpRegion &cas_ror, RdmaOpRegion &read_ror,
                    uint64_t equal, uint64_t val, bool signal,
                    CoroContext *ctx) {
-    read_cnt++;
-    read_bytes+=read_ror.size;
+  metrics[thread_id].record(DSMMetrics::kCasRead,
+                            sizeof(uint64_t) + read_ror.size);
   int node_id;
   {
     GlobalAddress gaddr;
@@ -297,10 +380,10 @@ void DSM::cas_read(RdmaOpRegion &cas_ror, RdmaOpRegion &read_ror,
   }
 
   if (ctx == nullptr) {
-    rdmaCasRead(iCon->data[0][node_id], cas_ror, read_ror, equal, val, signal);
+    transport->cas_read(node_id, cas_ror, read_ror, equal, val, signal);
   } else {
-    rdmaCasRead(iCon->data[0][node_id], cas_ror, read_ror, equal, val, true,
-                ctx->coro_id);
+    transport->cas_read(node_id, cas_ror, read_ror, equal, val, true,
+                        ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -310,8 +393,7 @@ bool DSM::cas_read_sync(RdmaOpRegion &cas_ror, RdmaOpRegion &read_ror,
   cas_read(cas_ror, read_ror, equal, val, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 
   return equal == *(uint64_t *)cas_ror.source;
@@ -319,17 +401,15 @@ bool DSM::cas_read_sync(RdmaOpRegion &cas_ror, RdmaOpRegion &read_ror,
 
 void DSM::cas(GlobalAddress gaddr, uint64_t equal, uint64_t val,
               uint64_t *rdma_buffer, bool signal, CoroContext *ctx) {
-    cas_cnt++;
+  metrics[thread_id].record(DSMMetrics::kCas, sizeof(uint64_t));
   if (ctx == nullptr) {
-    rdmaCompareAndSwap(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                       remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal,
-                       val, iCon->cacheLKey,
-                       remoteInfo[gaddr.nodeID].dsmRKey[0], signal);
+    transport->cas(gaddr.nodeID, (uint64_t)rdma_buffer,
+                   remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal, val,
+                   remoteInfo[gaddr.nodeID].dsmRKey[0], signal);
   } else {
-    rdmaCompareAndSwap(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                       remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal,
-                       val, iCon->cacheLKey,
-                       remoteInfo[gaddr.nodeID].dsmRKey[0], true, ctx->coro_id);
+    transport->cas(gaddr.nodeID, (uint64_t)rdma_buffer,
+                   remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal, val,
+                   remoteInfo[gaddr.nodeID].dsmRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -339,8 +419,7 @@ bool DSM::cas_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
   cas(gaddr, equal, val, rdma_buffer, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 
   return equal == *rdma_buffer;
@@ -348,18 +427,16 @@ bool DSM::cas_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
 
 void DSM::cas_mask(GlobalAddress gaddr, uint64_t equal, uint64_t val,
                    uint64_t *rdma_buffer, uint64_t mask, bool signal) {
-    cas_cnt++;
-  rdmaCompareAndSwapMask(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                         remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal,
-                         val, iCon->cacheLKey,
-                         remoteInfo[gaddr.nodeID].dsmRKey[0], mask, signal);
+  metrics[thread_id].record(DSMMetrics::kCasMask, sizeof(uint64_t));
+  transport->cas_mask(gaddr.nodeID, (uint64_t)rdma_buffer,
+                      remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset, equal,
+                      val, remoteInfo[gaddr.nodeID].dsmRKey[0], mask, signal);
 }
 
 bool DSM::cas_mask_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
                         uint64_t *rdma_buffer, uint64_t mask) {
   cas_mask(gaddr, equal, val, rdma_buffer, mask);
-  ibv_wc wc;
-  pollWithCQ(iCon->cq, 1, &wc);
+  transport->poll_cq(1);
 
   return (equal & mask) == (*rdma_buffer & mask);
 }
@@ -367,17 +444,17 @@ bool DSM::cas_mask_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
 void DSM::faa_boundary(GlobalAddress gaddr, uint64_t add_val,
                        uint64_t *rdma_buffer, uint64_t mask, bool signal,
                        CoroContext *ctx) {
+  metrics[thread_id].record(DSMMetrics::kFaa, sizeof(uint64_t));
   if (ctx == nullptr) {
-    rdmaFetchAndAddBoundary(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
+    transport->faa_boundary(gaddr.nodeID, (uint64_t)rdma_buffer,
                             remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset,
-                            add_val, iCon->cacheLKey,
-                            remoteInfo[gaddr.nodeID].dsmRKey[0], mask, signal);
+                            add_val, remoteInfo[gaddr.nodeID].dsmRKey[0], mask,
+                            signal);
   } else {
-    rdmaFetchAndAddBoundary(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
+    transport->faa_boundary(gaddr.nodeID, (uint64_t)rdma_buffer,
                             remoteInfo[gaddr.nodeID].dsmBase + gaddr.offset,
-                            add_val, iCon->cacheLKey,
-                            remoteInfo[gaddr.nodeID].dsmRKey[0], mask, true,
-                            ctx->coro_id);
+                            add_val, remoteInfo[gaddr.nodeID].dsmRKey[0], mask,
+                            true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -387,23 +464,21 @@ void DSM::faa_boundary_sync(GlobalAddress gaddr, uint64_t add_val,
                             CoroContext *ctx) {
   faa_boundary(gaddr, add_val, rdma_buffer, mask, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::read_dm(char *buffer, GlobalAddress gaddr, size_t size, bool signal,
                   CoroContext *ctx) {
-
+  metrics[thread_id].record(DSMMetrics::kReadDM, size);
   if (ctx == nullptr) {
-    rdmaRead(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-             remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
-             iCon->cacheLKey, remoteInfo[gaddr.nodeID].lockRKey[0], signal);
+    transport->read(gaddr.nodeID, (uint64_t)buffer,
+                    remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
+                    remoteInfo[gaddr.nodeID].lockRKey[0], signal);
   } else {
-    rdmaRead(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-             remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
-             iCon->cacheLKey, remoteInfo[gaddr.nodeID].lockRKey[0], true,
-             ctx->coro_id);
+    transport->read(gaddr.nodeID, (uint64_t)buffer,
+                    remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
+                    remoteInfo[gaddr.nodeID].lockRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -413,25 +488,21 @@ void DSM::read_dm_sync(char *buffer, GlobalAddress gaddr, size_t size,
   read_dm(buffer, gaddr, size, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::write_dm(const char *buffer, GlobalAddress gaddr, size_t size,
                    bool signal, CoroContext *ctx) {
-    write_cnt++;
-    write_bytes = write_bytes + size;
+  metrics[thread_id].record(DSMMetrics::kWriteDM, size);
   if (ctx == nullptr) {
-    rdmaWrite(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-              remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
-              iCon->cacheLKey, remoteInfo[gaddr.nodeID].lockRKey[0], -1,
-              signal);
+    transport->write(gaddr.nodeID, (uint64_t)buffer,
+                     remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
+                     remoteInfo[gaddr.nodeID].lockRKey[0], signal);
   } else {
-    rdmaWrite(iCon->data[0][gaddr.nodeID], (uint64_t)buffer,
-              remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
-              iCon->cacheLKey, remoteInfo[gaddr.nodeID].lockRKey[0], -1, true,
-              ctx->coro_id);
+    transport->write(gaddr.nodeID, (uint64_t)buffer,
+                     remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, size,
+                     remoteInfo[gaddr.nodeID].lockRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -441,25 +512,21 @@ void DSM::write_dm_sync(const char *buffer, GlobalAddress gaddr, size_t size,
   write_dm(buffer, gaddr, size, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
 void DSM::cas_dm(GlobalAddress gaddr, uint64_t equal, uint64_t val,
                  uint64_t *rdma_buffer, bool signal, CoroContext *ctx) {
-    cas_cnt++;
+  metrics[thread_id].record(DSMMetrics::kCasDM, sizeof(uint64_t));
   if (ctx == nullptr) {
-    rdmaCompareAndSwap(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                       remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, equal,
-                       val, iCon->cacheLKey,
-                       remoteInfo[gaddr.nodeID].lockRKey[0], signal);
+    transport->cas(gaddr.nodeID, (uint64_t)rdma_buffer,
+                   remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, equal, val,
+                   remoteInfo[gaddr.nodeID].lockRKey[0], signal);
   } else {
-    rdmaCompareAndSwap(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                       remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, equal,
-                       val, iCon->cacheLKey,
-                       remoteInfo[gaddr.nodeID].lockRKey[0], true,
-                       ctx->coro_id);
+    transport->cas(gaddr.nodeID, (uint64_t)rdma_buffer,
+                   remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, equal, val,
+                   remoteInfo[gaddr.nodeID].lockRKey[0], true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -469,8 +536,7 @@ bool DSM::cas_dm_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
   cas_dm(gaddr, equal, val, rdma_buffer, true, ctx);
 
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 
   return equal == *rdma_buffer;
@@ -478,17 +544,16 @@ bool DSM::cas_dm_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
 
 void DSM::cas_dm_mask(GlobalAddress gaddr, uint64_t equal, uint64_t val,
                       uint64_t *rdma_buffer, uint64_t mask, bool signal) {
-  rdmaCompareAndSwapMask(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
-                         remoteInfo[gaddr.nodeID].lockBase + gaddr.offset,
-                         equal, val, iCon->cacheLKey,
-                         remoteInfo[gaddr.nodeID].lockRKey[0], mask, signal);
+  metrics[thread_id].record(DSMMetrics::kCasMaskDM, sizeof(uint64_t));
+  transport->cas_mask(gaddr.nodeID, (uint64_t)rdma_buffer,
+                      remoteInfo[gaddr.nodeID].lockBase + gaddr.offset, equal,
+                      val, remoteInfo[gaddr.nodeID].lockRKey[0], mask, signal);
 }
 
 bool DSM::cas_dm_mask_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
                            uint64_t *rdma_buffer, uint64_t mask) {
   cas_dm_mask(gaddr, equal, val, rdma_buffer, mask);
-  ibv_wc wc;
-  pollWithCQ(iCon->cq, 1, &wc);
+  transport->poll_cq(1);
 
   return (equal & mask) == (*rdma_buffer & mask);
 }
@@ -496,18 +561,17 @@ bool DSM::cas_dm_mask_sync(GlobalAddress gaddr, uint64_t equal, uint64_t val,
 void DSM::faa_dm_boundary(GlobalAddress gaddr, uint64_t add_val,
                           uint64_t *rdma_buffer, uint64_t mask, bool signal,
                           CoroContext *ctx) {
+  metrics[thread_id].record(DSMMetrics::kFaaDM, sizeof(uint64_t));
   if (ctx == nullptr) {
-
-    rdmaFetchAndAddBoundary(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
+    transport->faa_boundary(gaddr.nodeID, (uint64_t)rdma_buffer,
                             remoteInfo[gaddr.nodeID].lockBase + gaddr.offset,
-                            add_val, iCon->cacheLKey,
-                            remoteInfo[gaddr.nodeID].lockRKey[0], mask, signal);
+                            add_val, remoteInfo[gaddr.nodeID].lockRKey[0], mask,
+                            signal);
   } else {
-    rdmaFetchAndAddBoundary(iCon->data[0][gaddr.nodeID], (uint64_t)rdma_buffer,
+    transport->faa_boundary(gaddr.nodeID, (uint64_t)rdma_buffer,
                             remoteInfo[gaddr.nodeID].lockBase + gaddr.offset,
-                            add_val, iCon->cacheLKey,
-                            remoteInfo[gaddr.nodeID].lockRKey[0], mask, true,
-                            ctx->coro_id);
+                            add_val, remoteInfo[gaddr.nodeID].lockRKey[0], mask,
+                            true, ctx->coro_id);
     (*ctx->yield)(*ctx->master);
   }
 }
@@ -517,23 +581,43 @@ void DSM::faa_dm_boundary_sync(GlobalAddress gaddr, uint64_t add_val,
                                CoroContext *ctx) {
   faa_dm_boundary(gaddr, add_val, rdma_buffer, mask, true, ctx);
   if (ctx == nullptr) {
-    ibv_wc wc;
-    pollWithCQ(iCon->cq, 1, &wc);
+    transport->poll_cq(1);
   }
 }
 
-uint64_t DSM::poll_rdma_cq(int count) {
-  ibv_wc wc;
-  pollWithCQ(iCon->cq, count, &wc);
+uint64_t DSM::poll_rdma_cq(int count) { return transport->poll_cq(count); }
 
-  return wc.wr_id;
+bool DSM::poll_rdma_cq_once(uint64_t &wr_id) {
+  return transport->poll_cq_once(wr_id);
 }
 
-bool DSM::poll_rdma_cq_once(uint64_t &wr_id) {
-  ibv_wc wc;
-  int res = pollOnce(iCon->cq, 1, &wc);
+DSMMetrics DSM::get_metrics(int thread_id) {
+  if (thread_id >= 0) {
+    return metrics[thread_id];
+  }
+
+  DSMMetrics all;
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    all.merge(metrics[i]);
+  }
+  return all;
+}
 
-  wr_id = wc.wr_id;
+LatencyHistogram DSM::get_malloc_latency(int thread_id) {
+  if (thread_id >= 0) {
+    return malloc_latency[thread_id];
+  }
+
+  LatencyHistogram all;
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    all.merge(malloc_latency[i]);
+  }
+  return all;
+}
 
-  return res == 1;
-}
\ No newline at end of file
+void DSM::clear_metrics() {
+  for (int i = 0; i < MAX_APP_THREAD; ++i) {
+    metrics[i].clear();
+    malloc_latency[i].clear();
+  }
+}
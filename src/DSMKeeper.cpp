@@ -21,10 +21,11 @@ void DSMKeeper::initLocalMeta() {
   }
 
   // per thread DIR
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < dirNR; ++i) {
     localMeta.dirTh[i].lid = dirCon[i]->ctx.lid;
     localMeta.dirTh[i].rKey = dirCon[i]->dsmMR->rkey;
-    localMeta.dirTh[i].lock_rkey = dirCon[i]->lockMR->rkey;
+    // only directory 0 registers the on-chip memory
+    localMeta.dirTh[i].lock_rkey = i == 0 ? dirCon[i]->lockMR->rkey : 0;
     memcpy((char *)localMeta.dirTh[i].gid, (char *)(&dirCon[i]->ctx.gid),
            16 * sizeof(uint8_t));
 
@@ -50,7 +51,7 @@ bool DSMKeeper::connectNode(uint16_t remoteID) {
 }
 
 void DSMKeeper::setDataToRemote(uint16_t remoteID) {
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < dirNR; ++i) {
     auto &c = dirCon[i];
 
     for (int k = 0; k < MAX_APP_THREAD; ++k) {
@@ -60,7 +61,7 @@ void DSMKeeper::setDataToRemote(uint16_t remoteID) {
 
   for (int i = 0; i < MAX_APP_THREAD; ++i) {
     auto &c = thCon[i];
-    for (int k = 0; k < NR_DIRECTORY; ++k) {
+    for (uint32_t k = 0; k < dirNR; ++k) {
       localMeta.appRcQpn2dir[i][k] = c->data[k][remoteID]->qp_num;
     }
   
@@ -68,7 +69,7 @@ void DSMKeeper::setDataToRemote(uint16_t remoteID) {
 }
 
 void DSMKeeper::setDataFromRemote(uint16_t remoteID, ExchangeMeta *remoteMeta) {
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < dirNR; ++i) {
     auto &c = dirCon[i];
 
     for (int k = 0; k < MAX_APP_THREAD; ++k) {
@@ -85,7 +86,7 @@ void DSMKeeper::setDataFromRemote(uint16_t remoteID, ExchangeMeta *remoteMeta) {
 
   for (int i = 0; i < MAX_APP_THREAD; ++i) {
     auto &c = thCon[i];
-    for (int k = 0; k < NR_DIRECTORY; ++k) {
+    for (uint32_t k = 0; k < dirNR; ++k) {
       auto &qp = c->data[k][remoteID];
 
       assert(qp->qp_type == IBV_QPT_RC);
@@ -102,7 +103,7 @@ void DSMKeeper::setDataFromRemote(uint16_t remoteID, ExchangeMeta *remoteMeta) {
   info.cacheBase = remoteMeta->cacheBase;
   info.lockBase = remoteMeta->lockBase;
 
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < dirNR; ++i) {
     info.dsmRKey[i] = remoteMeta->dirTh[i].rKey;
     info.lockRKey[i] = remoteMeta->dirTh[i].lock_rkey;
     info.dirMessageQPN[i] = remoteMeta->dirUdQpn[i];
@@ -122,7 +123,7 @@ void DSMKeeper::setDataFromRemote(uint16_t remoteID, ExchangeMeta *remoteMeta) {
     info.appRKey[i] = remoteMeta->appTh[i].rKey;
     info.appMessageQPN[i] = remoteMeta->appUdQpn[i];
 
-    for (int k = 0; k < NR_DIRECTORY; ++k) {
+    for (uint32_t k = 0; k < dirNR; ++k) {
       struct ibv_ah_attr ahAttr;
       fillAhAttr(&ahAttr, remoteMeta->appTh[i].lid, remoteMeta->appTh[i].gid,
                  &dirCon[k]->ctx);
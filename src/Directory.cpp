@@ -5,24 +5,40 @@
 
 GlobalAddress g_root_ptr = GlobalAddress::Null();
 int g_root_level = -1;
-bool enable_cache;
+bool enable_cache = true;
+// copies of hot leaves, checked on each hit unless within the lease
+bool enable_leaf_cache = false;
+uint64_t leaf_cache_lease_ns = 0;
 
 Directory::Directory(DirectoryConnection *dCon, RemoteConnection *remoteInfo,
-                     uint32_t machineNR, uint16_t dirID, uint16_t nodeID)
+                     uint32_t machineNR, uint16_t dirID, uint32_t dirNR,
+                     uint16_t nodeID)
     : dCon(dCon), remoteInfo(remoteInfo), machineNR(machineNR), dirID(dirID),
       nodeID(nodeID), dirTh(nullptr) {
 
-  { // chunck alloctor
-    GlobalAddress dsm_start;
-    uint64_t per_directory_dsm_size = dCon->dsmSize / NR_DIRECTORY;
-    dsm_start.nodeID = nodeID;
-    dsm_start.offset = per_directory_dsm_size * dirID;
-    chunckAlloc = new GlobalAllocator(dsm_start, per_directory_dsm_size);
-  }
+  init_allocator(dCon->dsmSize, dirNR);
 
   dirTh = new std::thread(&Directory::dirThread, this);
 }
 
+Directory::Directory(uint64_t dsmSize, uint16_t dirID, uint32_t dirNR,
+                     uint16_t nodeID)
+    : dCon(nullptr), remoteInfo(nullptr), machineNR(0), dirID(dirID),
+      nodeID(nodeID), dirTh(nullptr) {
+
+  init_allocator(dsmSize, dirNR);
+}
+
+void Directory::init_allocator(uint64_t dsmSize,
+                               uint32_t dirNR) { // chunck alloctor
+  GlobalAddress dsm_start;
+  uint64_t per_directory_dsm_size = dsmSize / dirNR;
+  assert(per_directory_dsm_size % define::kChunkSize == 0);
+  dsm_start.nodeID = nodeID;
+  dsm_start.offset = per_directory_dsm_size * dirID;
+  chunckAlloc = new GlobalAllocator(dsm_start, per_directory_dsm_size);
+}
+
 Directory::~Directory() { delete chunckAlloc; }
 
 void Directory::dirThread() {
@@ -59,13 +75,44 @@ void Directory::dirThread() {
 
 void Directory::process_message(const RawMessage *m) {
 
-  RawMessage *send = nullptr;
+  RawMessage reply;
+  if (serve(m, &reply)) {
+    auto send = (RawMessage *)dCon->message->getSendPool();
+    memcpy(send, &reply, sizeof(RawMessage));
+    dCon->sendMessage2App(send, m->node_id, m->app_id);
+  }
+}
+
+bool Directory::serve(const RawMessage *m, RawMessage *reply) {
+
+  bool need_reply = false;
   switch (m->type) {
   case RpcType::MALLOC: {
 
-    send = (RawMessage *)dCon->message->getSendPool();
+    // fewer (or none) if the directory runs out
+    reply->chunk_cnt = 0;
+    while (reply->chunk_cnt < m->chunk_cnt &&
+           reply->chunk_cnt < define::kChunksPerMalloc &&
+           chunckAlloc->used_chunks() < chunckAlloc->total_chunks()) {
+      reply->chunks[reply->chunk_cnt++] = chunckAlloc->alloc_chunck();
+    }
+    reply->used_chunks = chunckAlloc->used_chunks();
+    reply->total_chunks = chunckAlloc->total_chunks();
+    need_reply = true;
+    break;
+  }
+
+  case RpcType::FREE: {
 
-    send->addr = chunckAlloc->alloc_chunck();
+    chunckAlloc->free_chunk(m->addr);
+    break;
+  }
+
+  case RpcType::ALLOC_STAT: {
+
+    reply->used_chunks = chunckAlloc->used_chunks();
+    reply->total_chunks = chunckAlloc->total_chunks();
+    need_reply = true;
     break;
   }
 
@@ -74,9 +121,6 @@ void Directory::process_message(const RawMessage *m) {
     if (g_root_level < m->level) {
       g_root_ptr = m->addr;
       g_root_level = m->level;
-      if (g_root_level >= 3) {
-        enable_cache = false;
-      }
     }
 
     break;
@@ -86,7 +130,5 @@ void Directory::process_message(const RawMessage *m) {
     assert(false);
   }
 
-  if (send) {
-    dCon->sendMessage2App(send, m->node_id, m->app_id);
-  }
+  return need_reply;
 }
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include "EmulatedTransport.h"
+#include "Directory.h"
+
+// rdma moves a page front to back, and readers rely on that to catch a torn
+// page with its front and rear versions; memcpy may copy the tail first
+static void ordered_copy(char *to, const char *from, uint64_t size) {
+  uint64_t i = 0;
+  if ((((uint64_t)to | (uint64_t)from) & 7) == 0) {
+    for (; i + 8 <= size; i += 8) {
+      *(volatile uint64_t *)(to + i) = *(const volatile uint64_t *)(from + i);
+    }
+  }
+  for (; i < size; ++i) {
+    *(volatile char *)(to + i) = *(const volatile char *)(from + i);
+  }
+}
+
+EmulatedFabric::EmulatedFabric(uint32_t machineNR, uint64_t dsmSize,
+                               uint32_t dirNR)
+    : machineNR(machineNR), dsmSize(dsmSize), dirNR(dirNR) {
+
+  assert(machineNR <= MAX_MACHINE && dirNR <= MAX_DIRECTORY);
+
+  dsmPool = (char *)hugePageAlloc(machineNR * dsmSize);
+  lockPool = (char *)aligned_alloc(define::kCacheLineSize,
+                                   machineNR * define::kLockChipMemSize);
+
+  for (uint32_t i = 0; i < machineNR; ++i) {
+    // clear up first chunk (root pointers)
+    memset((char *)dsm_base(i), 0, define::kChunkSize);
+    memset((char *)lock_base(i), 0, define::kLockChipMemSize);
+
+    for (uint32_t k = 0; k < dirNR; ++k) {
+      dirAgent[i][k] = new Directory(dsmSize, k, dirNR, i);
+    }
+  }
+
+  Debug::notifyInfo("emulated memory nodes: %d, %ldGB per node", machineNR,
+                    dsmSize / define::GB);
+}
+
+EmulatedFabric::~EmulatedFabric() {
+  for (uint32_t i = 0; i < machineNR; ++i) {
+    for (uint32_t k = 0; k < dirNR; ++k) {
+      delete dirAgent[i][k];
+    }
+  }
+  munmap(dsmPool, machineNR * dsmSize);
+  ::free(lockPool);
+}
+
+bool EmulatedFabric::serve_rpc(const RawMessage &m, uint16_t node_id,
+                               uint16_t dir_id, RawMessage *reply) {
+  assert(node_id < machineNR && dir_id < dirNR);
+
+  auto &l = dirLock[node_id][dir_id];
+  l.wLock();
+  bool res = dirAgent[node_id][dir_id]->serve(&m, reply);
+  l.wUnlock();
+
+  return res;
+}
+
+EmulatedTransport::EmulatedTransport(EmulatedFabric *fabric)
+    : fabric(fabric), cq_head(0), cq_tail(0), reply_cnt(0) {}
+
+inline void EmulatedTransport::complete(bool signal, uint64_t wrID) {
+  compiler_barrier();
+  if (!signal) {
+    return;
+  }
+
+  if (cq_tail - cq_head == kCqDepth) {
+    Debug::notifyError("emulated cq overflow");
+    assert(false);
+  }
+  cq[cq_tail % kCqDepth] = wrID;
+  cq_tail++;
+}
+
+static inline uint64_t cas_masked(uint64_t dest, uint64_t compare,
+                                  uint64_t swap, uint64_t mask) {
+  auto p = (volatile uint64_t *)dest;
+  while (true) {
+    uint64_t old = *p;
+    if ((old & mask) != (compare & mask)) {
+      return old;
+    }
+    uint64_t val = (old & ~mask) | (swap & mask);
+    if (__sync_bool_compare_and_swap(p, old, val)) {
+      return old;
+    }
+  }
+}
+
+// fetch-and-add whose carry does not cross the last bit of a field
+// (bits set in |boundary_mask|), as masked atomics of ConnectX NICs
+static inline uint64_t faa_masked(uint64_t dest, uint64_t add,
+                                  uint64_t boundary_mask) {
+  auto p = (volatile uint64_t *)dest;
+  while (true) {
+    uint64_t old = *p;
+    uint64_t val = 0;
+    uint64_t carry = 0;
+    for (int i = 0; i < 64; ++i) {
+      uint64_t s = ((old >> i) & 1) + ((add >> i) & 1) + carry;
+      val |= (s & 1) << i;
+      carry = ((boundary_mask >> i) & 1) ? 0 : (s >> 1);
+    }
+    if (__sync_bool_compare_and_swap(p, old, val)) {
+      return old;
+    }
+  }
+}
+
+bool EmulatedTransport::read(uint16_t node_id, uint64_t source, uint64_t dest,
+                             uint64_t size, uint32_t remoteRKey, bool signal,
+                             uint64_t wrID) {
+  ordered_copy((char *)source, (char *)dest, size);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::write(uint16_t node_id, uint64_t source,
+                              uint64_t dest, uint64_t size,
+                              uint32_t remoteRKey, bool signal,
+                              uint64_t wrID) {
+  ordered_copy((char *)dest, (char *)source, size);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::cas(uint16_t node_id, uint64_t source, uint64_t dest,
+                            uint64_t compare, uint64_t swap,
+                            uint32_t remoteRKey, bool signal, uint64_t wrID) {
+  *(uint64_t *)source =
+      __sync_val_compare_and_swap((uint64_t *)dest, compare, swap);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::cas_mask(uint16_t node_id, uint64_t source,
+                                 uint64_t dest, uint64_t compare,
+                                 uint64_t swap, uint32_t remoteRKey,
+                                 uint64_t mask, bool signal) {
+  *(uint64_t *)source = cas_masked(dest, compare, swap, mask);
+  complete(signal, 0);
+  return true;
+}
+
+bool EmulatedTransport::faa_boundary(uint16_t node_id, uint64_t source,
+                                     uint64_t dest, uint64_t add,
+                                     uint32_t remoteRKey, uint64_t boundary,
+                                     bool signal, uint64_t wrID) {
+  *(uint64_t *)source = faa_masked(dest, add, 1ull << boundary);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::write_batch(uint16_t node_id, RdmaOpRegion *ror,
+                                    int k, bool signal, uint64_t wrID) {
+  for (int i = 0; i < k; ++i) {
+    ordered_copy((char *)ror[i].dest, (char *)ror[i].source, ror[i].size);
+    compiler_barrier();
+  }
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::read_batch(uint16_t node_id, RdmaOpRegion *ror,
+                                   int k, bool signal, uint64_t wrID) {
+  for (int i = 0; i < k; ++i) {
+    ordered_copy((char *)ror[i].source, (char *)ror[i].dest, ror[i].size);
+  }
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::cas_read(uint16_t node_id,
+                                 const RdmaOpRegion &cas_ror,
+                                 const RdmaOpRegion &read_ror,
+                                 uint64_t compare, uint64_t swap, bool signal,
+                                 uint64_t wrID) {
+  *(uint64_t *)cas_ror.source =
+      __sync_val_compare_and_swap((uint64_t *)cas_ror.dest, compare, swap);
+  // fenced READ
+  ordered_copy((char *)read_ror.source, (char *)read_ror.dest, read_ror.size);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::write_faa(uint16_t node_id,
+                                  const RdmaOpRegion &write_ror,
+                                  const RdmaOpRegion &faa_ror,
+                                  uint64_t add_val, bool signal,
+                                  uint64_t wrID) {
+  ordered_copy((char *)write_ror.dest, (char *)write_ror.source,
+               write_ror.size);
+  *(uint64_t *)faa_ror.source =
+      __sync_fetch_and_add((uint64_t *)faa_ror.dest, add_val);
+  complete(signal, wrID);
+  return true;
+}
+
+bool EmulatedTransport::write_cas(uint16_t node_id,
+                                  const RdmaOpRegion &write_ror,
+                                  const RdmaOpRegion &cas_ror,
+                                  uint64_t compare, uint64_t swap,
+                                  bool signal, uint64_t wrID) {
+  ordered_copy((char *)write_ror.dest, (char *)write_ror.source,
+               write_ror.size);
+  *(uint64_t *)cas_ror.source =
+      __sync_val_compare_and_swap((uint64_t *)cas_ror.dest, compare, swap);
+  complete(signal, wrID);
+  return true;
+}
+
+uint64_t EmulatedTransport::poll_cq(int count) {
+  // verbs complete when they are posted, so waiting for completions
+  // which were never posted would block forever (as with a real CQ)
+  if (cq_tail - cq_head < (uint32_t)count) {
+    Debug::notifyError("poll %d completions, but only %d posted", count,
+                       cq_tail - cq_head);
+    assert(false);
+  }
+
+  cq_head += count;
+  return cq[(cq_head - 1) % kCqDepth];
+}
+
+bool EmulatedTransport::poll_cq_once(uint64_t &wr_id) {
+  if (cq_head == cq_tail) {
+    return false;
+  }
+
+  wr_id = cq[cq_head % kCqDepth];
+  cq_head++;
+  return true;
+}
+
+void EmulatedTransport::rpc_call_dir(const RawMessage &m, uint16_t node_id,
+                                     uint16_t dir_id) {
+  if (fabric->serve_rpc(m, node_id, dir_id, &reply)) {
+    reply_cnt++;
+  }
+}
+
+RawMessage *EmulatedTransport::rpc_wait() {
+  assert(reply_cnt > 0);
+  reply_cnt--;
+
+  return &reply;
+}
+
+// replies are ready when rpc_call_dir() returns
+RawMessage *EmulatedTransport::rpc_poll() {
+  return reply_cnt > 0 ? rpc_wait() : nullptr;
+}
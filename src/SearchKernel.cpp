@@ -0,0 +1,67 @@
+#include "SearchKernel.h"
+
+#include <immintrin.h>
+
+// AVX2, 4 keys per compare. there is no unsigned 64-bit compare before
+// AVX-512, so both sides are flipped at the sign bit first.
+// keys are sorted, so the first key greater than k ends the search
+__attribute__((target("avx2"))) static int
+key_rank_avx2(const UnalignedKey *keys, int n, Key k) {
+  const __m256i flip = _mm256_set1_epi64x(0x8000000000000000ull);
+  const __m256i target = _mm256_xor_si256(_mm256_set1_epi64x(k), flip);
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(v, flip), target);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  for (; i < n; ++i) {
+    if (keys[i] > k) {
+      return i;
+    }
+  }
+  return n;
+}
+
+// AVX-512F, 8 keys per compare
+__attribute__((target("avx512f"))) static int
+key_rank_avx512(const UnalignedKey *keys, int n, Key k) {
+  const __m512i target = _mm512_set1_epi64(k);
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i v = _mm512_loadu_si512((const void *)(keys + i));
+    __mmask8 mask = _mm512_cmpgt_epu64_mask(v, target);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  if (i < n) {
+    __mmask8 tail = (1u << (n - i)) - 1;
+    __m512i v = _mm512_maskz_loadu_epi64(tail, (const void *)(keys + i));
+    __mmask8 mask = _mm512_mask_cmpgt_epu64_mask(tail, v, target);
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return n;
+}
+
+static KeyRankFn pick_key_rank() {
+  __builtin_cpu_init(); // may run before the constructor of libgcc
+  if (__builtin_cpu_supports("avx512f")) {
+    return key_rank_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return key_rank_avx2;
+  }
+  return key_rank_scalar;
+}
+
+const KeyRankFn key_rank_kernel = pick_key_rank();
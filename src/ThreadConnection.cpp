@@ -4,6 +4,7 @@
 
 ThreadConnection::ThreadConnection(uint16_t threadID, void *cachePool,
                                    uint64_t cacheSize, uint32_t machineNR,
+                                   uint32_t dirNR,
                                    RemoteConnection *remoteInfo)
     : threadID(threadID), remoteInfo(remoteInfo) {
   createContext(&ctx);
@@ -19,7 +20,7 @@ ThreadConnection::ThreadConnection(uint16_t threadID, void *cachePool,
   cacheLKey = cacheMR->lkey;
 
   // dir, RC
-  for (int i = 0; i < NR_DIRECTORY; ++i) {
+  for (uint32_t i = 0; i < dirNR; ++i) {
     data[i] = new ibv_qp *[machineNR];
     for (size_t k = 0; k < machineNR; ++k) {
       createQueuePair(&data[i][k], IBV_QPT_RC, cq, &ctx);
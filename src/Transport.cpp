@@ -0,0 +1,115 @@
+#include "Transport.h"
+
+#include "Connection.h"
+
+RdmaTransport::RdmaTransport(ThreadConnection *iCon) : iCon(iCon) {
+  cacheLKey = iCon->cacheLKey;
+}
+
+bool RdmaTransport::read(uint16_t node_id, uint64_t source, uint64_t dest,
+                         uint64_t size, uint32_t remoteRKey, bool signal,
+                         uint64_t wrID) {
+  return rdmaRead(iCon->data[0][node_id], source, dest, size, cacheLKey,
+                  remoteRKey, signal, wrID);
+}
+
+bool RdmaTransport::write(uint16_t node_id, uint64_t source, uint64_t dest,
+                          uint64_t size, uint32_t remoteRKey, bool signal,
+                          uint64_t wrID) {
+  return rdmaWrite(iCon->data[0][node_id], source, dest, size, cacheLKey,
+                   remoteRKey, -1, signal, wrID);
+}
+
+bool RdmaTransport::cas(uint16_t node_id, uint64_t source, uint64_t dest,
+                        uint64_t compare, uint64_t swap, uint32_t remoteRKey,
+                        bool signal, uint64_t wrID) {
+  return rdmaCompareAndSwap(iCon->data[0][node_id], source, dest, compare,
+                            swap, cacheLKey, remoteRKey, signal, wrID);
+}
+
+bool RdmaTransport::cas_mask(uint16_t node_id, uint64_t source, uint64_t dest,
+                             uint64_t compare, uint64_t swap,
+                             uint32_t remoteRKey, uint64_t mask, bool signal) {
+  return rdmaCompareAndSwapMask(iCon->data[0][node_id], source, dest, compare,
+                                swap, cacheLKey, remoteRKey, mask, signal);
+}
+
+bool RdmaTransport::faa_boundary(uint16_t node_id, uint64_t source,
+                                 uint64_t dest, uint64_t add,
+                                 uint32_t remoteRKey, uint64_t boundary,
+                                 bool signal, uint64_t wrID) {
+  return rdmaFetchAndAddBoundary(iCon->data[0][node_id], source, dest, add,
+                                 cacheLKey, remoteRKey, boundary, signal,
+                                 wrID);
+}
+
+bool RdmaTransport::write_batch(uint16_t node_id, RdmaOpRegion *ror, int k,
+                                bool signal, uint64_t wrID) {
+  return rdmaWriteBatch(iCon->data[0][node_id], ror, k, signal, wrID);
+}
+
+bool RdmaTransport::read_batch(uint16_t node_id, RdmaOpRegion *ror, int k,
+                               bool signal, uint64_t wrID) {
+  return rdmaReadBatch(iCon->data[0][node_id], ror, k, signal, wrID);
+}
+
+bool RdmaTransport::cas_read(uint16_t node_id, const RdmaOpRegion &cas_ror,
+                             const RdmaOpRegion &read_ror, uint64_t compare,
+                             uint64_t swap, bool signal, uint64_t wrID) {
+  return rdmaCasRead(iCon->data[0][node_id], cas_ror, read_ror, compare, swap,
+                     signal, wrID);
+}
+
+bool RdmaTransport::write_faa(uint16_t node_id, const RdmaOpRegion &write_ror,
+                              const RdmaOpRegion &faa_ror, uint64_t add_val,
+                              bool signal, uint64_t wrID) {
+  return rdmaWriteFaa(iCon->data[0][node_id], write_ror, faa_ror, add_val,
+                      signal, wrID);
+}
+
+bool RdmaTransport::write_cas(uint16_t node_id, const RdmaOpRegion &write_ror,
+                              const RdmaOpRegion &cas_ror, uint64_t compare,
+                              uint64_t swap, bool signal, uint64_t wrID) {
+  return rdmaWriteCas(iCon->data[0][node_id], write_ror, cas_ror, compare,
+                      swap, signal, wrID);
+}
+
+uint64_t RdmaTransport::poll_cq(int count) {
+  ibv_wc wc;
+  pollWithCQ(iCon->cq, count, &wc);
+
+  return wc.wr_id;
+}
+
+bool RdmaTransport::poll_cq_once(uint64_t &wr_id) {
+  ibv_wc wc;
+  int res = pollOnce(iCon->cq, 1, &wc);
+
+  wr_id = wc.wr_id;
+
+  return res == 1;
+}
+
+void RdmaTransport::rpc_call_dir(const RawMessage &m, uint16_t node_id,
+                                 uint16_t dir_id) {
+  auto buffer = (RawMessage *)iCon->message->getSendPool();
+
+  memcpy(buffer, &m, sizeof(RawMessage));
+  iCon->sendMessage2Dir(buffer, node_id, dir_id);
+}
+
+RawMessage *RdmaTransport::rpc_wait() {
+  ibv_wc wc;
+
+  pollWithCQ(iCon->rpc_cq, 1, &wc);
+  return (RawMessage *)iCon->message->getMessage();
+}
+
+RawMessage *RdmaTransport::rpc_poll() {
+  ibv_wc wc;
+
+  if (pollOnce(iCon->rpc_cq, 1, &wc) != 1) {
+    return nullptr;
+  }
+  return (RawMessage *)iCon->message->getMessage();
+}
@@ -1,5 +1,7 @@
 #include "Tree.h"
+#include "Histogram.h"
 #include "IndexCache.h"
+#include "LeafCache.h"
 #include "RdmaBuffer.h"
 #include "Timer.h"
 
@@ -14,7 +16,7 @@ bool enter_debug = false;
 
 uint64_t cache_miss[MAX_APP_THREAD][8];
 uint64_t cache_hit[MAX_APP_THREAD][8];
-uint64_t latency[MAX_APP_THREAD][LATENCY_WINDOWS];
+LatencyHistogram latency[MAX_APP_THREAD];
 
 thread_local CoroCall Tree::worker[define::kMaxCoro];
 thread_local CoroCall Tree::master;
@@ -22,7 +24,20 @@ thread_local GlobalAddress path_stack[define::kMaxCoro]
                                      [define::kMaxLevelOfTree];
 
 thread_local Timer timer;
-thread_local std::queue<uint16_t> hot_wait_queue;
+
+// where the sibling of a splitting page goes (Placement::NEAR_PARENT):
+// next to their parent, or the page itself when the path started below it
+static inline GlobalAddress placement_hint(GlobalAddress page_addr, int level,
+                                           int coro_id) {
+  GlobalAddress parent = GlobalAddress::Null();
+  if (level + 1 < (int)define::kMaxLevelOfTree) {
+    parent = path_stack[coro_id][level + 1];
+  }
+  return parent != GlobalAddress::Null() ? parent : page_addr;
+}
+
+extern bool enable_leaf_cache;
+extern uint64_t leaf_cache_lease_ns;
 
 Tree::Tree(DSM *dsm, uint16_t tree_id) : dsm(dsm), tree_id(tree_id) {
 
@@ -40,6 +55,9 @@ Tree::Tree(DSM *dsm, uint16_t tree_id) : dsm(dsm), tree_id(tree_id) {
   print_verbose();
 
   index_cache = new IndexCache(define::kIndexCacheSize);
+  leaf_cache = enable_leaf_cache
+                   ? new LeafCache(define::kLeafCacheSize, leaf_cache_lease_ns)
+                   : nullptr;
 
   root_ptr_ptr = get_root_ptr_ptr();
 
@@ -77,7 +95,8 @@ void Tree::print_verbose() {
               << "]" << std::endl;
     std::cout << "Leaf per Page: " << kLeafCardinality << std::endl;
     std::cout << "LeafEntry size: " << sizeof(LeafEntry) << std::endl;
-    std::cout << "InternalEntry size: " << sizeof(InternalEntry) << std::endl;
+    std::cout << "InternalEntry size: " << sizeof(Key) + sizeof(GlobalAddress)
+              << std::endl;
   }
 }
 
@@ -113,6 +132,21 @@ GlobalAddress Tree::get_root_ptr(CoroContext *cxt, int coro_id) {
   // std::cout << "root ptr " << root_ptr << std::endl;
 }
 
+// a traversal for k which missed the level-1 cache starts from the child
+// of the deepest cached upper page covering k (*entry), else the root
+GlobalAddress Tree::traversal_start(const Key &k, GlobalAddress root,
+                                    const CacheEntry **entry) {
+  *entry = nullptr;
+  if (!enable_cache) {
+    return root;
+  }
+
+  GlobalAddress addr;
+  int level;
+  *entry = index_cache->search_upper_from_cache(k, &addr, &level);
+  return *entry ? addr : root;
+}
+
 void Tree::broadcast_new_root(GlobalAddress new_root_addr, int root_level) {
   RawMessage m;
   m.type = RpcType::NEW_ROOT;
@@ -132,7 +166,7 @@ bool Tree::update_new_root(GlobalAddress left, const Key &k,
   auto cas_buffer = dsm->get_rbuf(coro_id).get_cas_buffer();
   auto new_root = new (page_buffer) InternalPage(left, k, right, level);
 
-  auto new_root_addr = dsm->alloc(kInternalPageSize);
+  auto new_root_addr = dsm->alloc(kInternalPageSize, left, cxt);
 
   new_root->set_consistent();
   dsm->write_sync(page_buffer, new_root_addr, kInternalPageSize, cxt);
@@ -148,6 +182,196 @@ bool Tree::update_new_root(GlobalAddress left, const Key &k,
   return false;
 }
 
+namespace {
+// pages of one level are allocated one by one, so they are back to back
+// inside a chunk from DSM::alloc; they are staged in registered memory and
+// written with one WRITE per contiguous run (double buffered)
+class PageStager {
+public:
+  PageStager(DSM *dsm, char *buffer, size_t size)
+      : dsm(dsm), half(size / 2), cur(0), len(0), pending(false) {
+    buf[0] = buffer;
+    buf[1] = buffer + half;
+  }
+
+  char *stage(GlobalAddress addr, size_t page_size) {
+    if (len > 0 &&
+        (addr != GADD(run_start, len) || len + page_size > half)) {
+      flush();
+    }
+    if (len == 0) {
+      run_start = addr;
+    }
+
+    char *res = buf[cur] + len;
+    len += page_size;
+    return res;
+  }
+
+  void finish() {
+    flush();
+    if (pending) {
+      dsm->poll_rdma_cq(1);
+      pending = false;
+    }
+  }
+
+private:
+  DSM *dsm;
+  char *buf[2];
+  size_t half;
+  int cur;
+  size_t len;
+  GlobalAddress run_start;
+  bool pending; // WRITE of the other buffer
+
+  void flush() {
+    if (len == 0) {
+      return;
+    }
+    if (pending) {
+      dsm->poll_rdma_cq(1);
+    }
+    dsm->write(buf[cur], run_start, len, true);
+    pending = true;
+
+    cur = 1 - cur;
+    len = 0;
+  }
+};
+} // namespace
+
+// build the tree bottom-up from a stream of strictly increasing keys,
+// filling pages to |fill_factor|, then install the root with one CAS.
+// the tree must be empty and not accessed by others during loading
+bool Tree::bulk_load(const KVStream &next, double fill_factor) {
+  assert(dsm->is_register());
+  assert(fill_factor > 0 && fill_factor <= 1);
+
+  auto old_root = get_root_ptr(nullptr, 0);
+  {
+    auto page_buffer = (dsm->get_rbuf(0)).get_page_buffer();
+    dsm->read_sync(page_buffer, old_root, kLeafPageSize);
+    auto page = (LeafPage *)page_buffer;
+
+    bool empty = page->hdr.level == 0;
+    for (int i = 0; empty && i < kLeafCardinality; ++i) {
+      empty = page->records[i].value == kValueNull;
+    }
+    if (!empty) {
+      Debug::notifyError("bulk load into a non-empty tree");
+      return false;
+    }
+  }
+
+  const int leaf_fill = std::max(
+      1, std::min(kLeafCardinality - 1, int(kLeafCardinality * fill_factor)));
+  const int fanout =
+      std::max(3, std::min(kInternalCardinality,
+                           int(kInternalCardinality * fill_factor)));
+
+  PageStager stager(dsm, dsm->get_bulk_buffer(), define::kBulkRdmaBuf);
+
+  // lowest key and address of each page of the level just built
+  std::vector<std::pair<Key, GlobalAddress>> pages;
+
+  // leaves
+  LeafPage *leaf = nullptr;
+  int leaf_cnt = 0;
+  uint64_t kv_cnt = 0;
+  Key k;
+  Value v;
+  while (next(k, v)) {
+    if (leaf == nullptr || leaf_cnt == leaf_fill) {
+      auto addr = dsm->alloc(kLeafPageSize);
+      Key lowest = kKeyMin;
+      if (leaf != nullptr) {
+        lowest = k;
+        leaf->hdr.sibling_ptr = addr;
+        leaf->hdr.highest = lowest;
+        leaf->set_consistent();
+      }
+
+      leaf = new (stager.stage(addr, kLeafPageSize)) LeafPage(0);
+      leaf->hdr.lowest = lowest;
+      leaf_cnt = 0;
+      pages.push_back(std::make_pair(lowest, addr));
+    }
+    assert(leaf_cnt == 0 || k > leaf->records[leaf_cnt - 1].key);
+
+    leaf->records[leaf_cnt].key = k;
+    leaf->records[leaf_cnt].value = v;
+    leaf->update_fp(leaf_cnt);
+    leaf->hdr.last_index++;
+    leaf_cnt++;
+    kv_cnt++;
+  }
+
+  if (leaf == nullptr) { // empty stream
+    auto addr = dsm->alloc(kLeafPageSize);
+    leaf = new (stager.stage(addr, kLeafPageSize)) LeafPage(0);
+    pages.push_back(std::make_pair(kKeyMin, addr));
+  }
+  leaf->set_consistent();
+
+  uint64_t leaf_nr = pages.size();
+
+  // internal levels, children are spread evenly over the pages of a level
+  int level = 0;
+  std::vector<std::pair<Key, GlobalAddress>> upper;
+  while (pages.size() > 1) {
+    level++;
+    assert(level < (int)define::kMaxLevelOfTree);
+
+    size_t n = pages.size();
+    size_t page_nr = (n + fanout - 1) / fanout;
+
+    InternalPage *page = nullptr;
+    upper.clear();
+    for (size_t p = 0; p < page_nr; ++p) {
+      size_t from = n * p / page_nr;
+      size_t to = n * (p + 1) / page_nr;
+
+      auto addr = dsm->alloc(kInternalPageSize);
+      if (page != nullptr) {
+        page->hdr.sibling_ptr = addr;
+        page->hdr.highest = pages[from].first;
+        page->set_consistent();
+      }
+
+      page = new (stager.stage(addr, kInternalPageSize)) InternalPage(level);
+      page->hdr.lowest = pages[from].first;
+      page->hdr.leftmost_ptr = pages[from].second;
+      for (size_t i = from + 1; i < to; ++i) {
+        page->keys[i - from - 1] = pages[i].first;
+        page->ptrs[i - from - 1] = pages[i].second;
+      }
+      page->hdr.last_index = to - from - 2;
+
+      upper.push_back(std::make_pair(pages[from].first, addr));
+    }
+    page->set_consistent();
+
+    pages.swap(upper);
+  }
+
+  stager.finish();
+
+  auto root = pages[0].second;
+  auto cas_buffer = (dsm->get_rbuf(0)).get_cas_buffer();
+  if (!dsm->cas_sync(root_ptr_ptr, old_root, root, cas_buffer)) {
+    Debug::notifyError("bulk load: root changed during loading");
+    return false;
+  }
+  broadcast_new_root(root, level);
+  dsm->free(old_root, kLeafPageSize); // the empty leaf
+
+  std::cout << "bulk load " << kv_cnt << " keys, " << leaf_nr
+            << " leaves, root level " << level << " " << root << std::endl;
+
+  return true;
+}
+
 void Tree::print_and_check_tree(CoroContext *cxt, int coro_id) {
   assert(dsm->is_register());
 
@@ -210,35 +434,38 @@ inline bool Tree::try_lock_addr(GlobalAddress lock_addr, uint64_t tag,
     return true;
   }
 
-  {
+  spin_lock_addr(lock_addr, tag, buf, cxt);
 
-    uint64_t retry_cnt = 0;
-    uint64_t pre_tag = 0;
-    uint64_t conflict_tag = 0;
-  retry:
-    retry_cnt++;
-    if (retry_cnt > 1000000) {
-      std::cout << "Deadlock " << lock_addr << std::endl;
-
-      std::cout << dsm->getMyNodeID() << ", " << dsm->getMyThreadID()
-                << " locked by " << (conflict_tag >> 32) << ", "
-                << (conflict_tag << 32 >> 32) << std::endl;
-      assert(false);
-    }
+  return true;
+}
+
+// CAS the remote lock until it is ours
+inline void Tree::spin_lock_addr(GlobalAddress lock_addr, uint64_t tag,
+                                 uint64_t *buf, CoroContext *cxt) {
+  uint64_t retry_cnt = 0;
+  uint64_t pre_tag = 0;
+  uint64_t conflict_tag = 0;
+retry:
+  retry_cnt++;
+  if (retry_cnt > 1000000) {
+    std::cout << "Deadlock " << lock_addr << std::endl;
+
+    std::cout << dsm->getMyNodeID() << ", " << dsm->getMyThreadID()
+              << " locked by " << (conflict_tag >> 32) << ", "
+              << (conflict_tag << 32 >> 32) << std::endl;
+    assert(false);
+  }
 
-    bool res = dsm->cas_dm_sync(lock_addr, 0, tag, buf, cxt);
+  bool res = dsm->cas_dm_sync(lock_addr, 0, tag, buf, cxt);
 
-    if (!res) {
-      conflict_tag = *buf - 1;
-      if (conflict_tag != pre_tag) {
-        retry_cnt = 0;
-        pre_tag = conflict_tag;
-      }
-      goto retry;
+  if (!res) {
+    conflict_tag = *buf - 1;
+    if (conflict_tag != pre_tag) {
+      retry_cnt = 0;
+      pre_tag = conflict_tag;
     }
+    goto retry;
   }
-
-  return true;
 }
 
 inline void Tree::unlock_addr(GlobalAddress lock_addr, uint64_t tag,
@@ -297,13 +524,83 @@ void Tree::write_page_and_unlock(char *page_buffer, GlobalAddress page_addr,
   releases_local_lock(lock_addr);
 }
 
+// write back records [lo, hi] of a locked leaf, with the lock release
+void Tree::write_leaf_and_unlock(LeafPage *page, int lo, int hi,
+                                 GlobalAddress page_addr, uint64_t *cas_buffer,
+                                 GlobalAddress lock_addr, uint64_t tag,
+                                 CoroContext *cxt, int coro_id) {
+  auto update_addr = (char *)&page->records[lo];
+  auto update_size = (hi - lo + 1) * sizeof(LeafEntry);
+
+#ifdef CONFIG_ENABLE_LEAF_FP
+  // fingerprints go in the same post, before the records
+  RdmaOpRegion rs[3];
+  rs[0].source = (uint64_t)&page->fp[lo];
+  rs[0].dest = GADD(page_addr, ((char *)&page->fp[lo] - (char *)page));
+  rs[0].size = hi - lo + 1;
+  rs[0].is_on_chip = false;
+
+  rs[1].source = (uint64_t)update_addr;
+  rs[1].dest = GADD(page_addr, (update_addr - (char *)page));
+  rs[1].size = update_size;
+  rs[1].is_on_chip = false;
+
+  if (can_hand_over(lock_addr)) {
+    dsm->write_batch_sync(rs, 2, cxt);
+    releases_local_lock(lock_addr);
+    return;
+  }
+
+  rs[2].source = (uint64_t)dsm->get_rbuf(coro_id).get_cas_buffer();
+  rs[2].dest = lock_addr;
+  rs[2].size = sizeof(uint64_t);
+  rs[2].is_on_chip = true;
+
+  *(uint64_t *)rs[2].source = 0;
+  dsm->write_batch_sync(rs, 3, cxt);
+
+  releases_local_lock(lock_addr);
+#else
+  write_page_and_unlock(update_addr,
+                        GADD(page_addr, (update_addr - (char *)page)),
+                        update_size, cas_buffer, lock_addr, tag, cxt, coro_id,
+                        false);
+#endif
+}
+
 void Tree::lock_and_read_page(char *page_buffer, GlobalAddress page_addr,
                               int page_size, uint64_t *cas_buffer,
                               GlobalAddress lock_addr, uint64_t tag,
                               CoroContext *cxt, int coro_id) {
 
-  try_lock_addr(lock_addr, tag, cas_buffer, cxt, coro_id);
+  bool hand_over = acquire_local_lock(lock_addr, cxt, coro_id);
+  if (hand_over) {
+    dsm->read_sync(page_buffer, page_addr, page_size, cxt);
+    return;
+  }
 
+  // first try: the lock CAS and the page READ in one post, one round trip.
+  // the READ is fenced behind the CAS, so the page is read under the lock
+  // if the CAS wins; otherwise the page is dropped and read again after
+  // spinning on the lock
+  assert(lock_addr.nodeID == page_addr.nodeID);
+  RdmaOpRegion cas_ror;
+  cas_ror.source = (uint64_t)cas_buffer;
+  cas_ror.dest = lock_addr;
+  cas_ror.size = sizeof(uint64_t);
+  cas_ror.is_on_chip = true;
+
+  RdmaOpRegion read_ror;
+  read_ror.source = (uint64_t)page_buffer;
+  read_ror.dest = page_addr;
+  read_ror.size = page_size;
+  read_ror.is_on_chip = false;
+
+  if (dsm->cas_read_sync(cas_ror, read_ror, 0, tag, cxt)) {
+    return;
+  }
+
+  spin_lock_addr(lock_addr, tag, cas_buffer, cxt);
   dsm->read_sync(page_buffer, page_addr, page_size, cxt);
 }
 
@@ -337,6 +634,10 @@ next:
   }
 
   assert(result.level != 0);
+  if (result.level == level) { // the root is the page to store in
+    internal_page_store(p, k, v, root, level, cxt, coro_id);
+    return;
+  }
   if (result.slibing != GlobalAddress::Null()) {
     p = result.slibing;
     goto next;
@@ -357,8 +658,7 @@ void Tree::insert(const Key &k, const Value &v, CoroContext *cxt, int coro_id) {
 
   if (enable_cache) {
     GlobalAddress cache_addr;
-    auto entry = index_cache->search_from_cache(k, &cache_addr,
-                                                dsm->getMyThreadID() == 0);
+    auto entry = index_cache->search_from_cache(k, &cache_addr);
     if (entry) { // cache hit
       auto root = get_root_ptr(cxt, coro_id);
       if (leaf_page_store(cache_addr, k, v, root, 0, cxt, coro_id, true)) {
@@ -375,16 +675,24 @@ void Tree::insert(const Key &k, const Value &v, CoroContext *cxt, int coro_id) {
   auto root = get_root_ptr(cxt, coro_id);
   SearchResult result;
 
-  GlobalAddress p = root;
+  const CacheEntry *entry;
+  GlobalAddress p = traversal_start(k, root, &entry);
 
 next:
 
-  if (!page_search(p, k, result, cxt, coro_id)) {
+  if (!page_search(p, k, result, cxt, coro_id, entry != nullptr)) {
+    if (entry) { // cache stale, from root
+      index_cache->invalidate(entry);
+      entry = nullptr;
+      p = root;
+      goto next;
+    }
     std::cout << "SEARCH WARNING insert" << std::endl;
     p = get_root_ptr(cxt, coro_id);
     sleep(1);
     goto next;
   }
+  entry = nullptr;
 
   if (!result.is_leaf) {
     assert(result.level != 0);
@@ -402,6 +710,86 @@ next:
   leaf_page_store(p, k, v, root, 0, cxt, coro_id);
 }
 
+// keys are grouped by the leaf they fall into, so each leaf is locked,
+// read and written back once per batch instead of once per key
+void Tree::insert_batch(const Key *keys, const Value *values, int n,
+                        CoroContext *cxt, int coro_id) {
+  assert(dsm->is_register());
+
+  // stable: the last value of a duplicated key wins
+  std::vector<int> order(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [keys](int a, int b) { return keys[a] < keys[b]; });
+
+  int done = 0;
+  while (done < n) {
+    const int *idx = order.data() + done;
+    const Key &k = keys[idx[0]];
+
+    before_operation(cxt, coro_id);
+
+    if (enable_cache) {
+      GlobalAddress cache_addr;
+      auto entry = index_cache->search_from_cache(k, &cache_addr);
+      if (entry) { // cache hit
+        auto root = get_root_ptr(cxt, coro_id);
+        int stored = leaf_page_store_batch(cache_addr, keys, values, idx,
+                                           n - done, root, 0, cxt, coro_id,
+                                           true);
+        if (stored > 0) {
+          cache_hit[dsm->getMyThreadID()][0]++;
+          done += stored;
+          continue;
+        }
+        // cache stale, from root,
+        index_cache->invalidate(entry);
+      }
+      cache_miss[dsm->getMyThreadID()][0]++;
+    }
+
+    auto root = get_root_ptr(cxt, coro_id);
+    SearchResult result;
+
+    const CacheEntry *entry;
+    GlobalAddress p = traversal_start(k, root, &entry);
+
+  next:
+
+    if (!page_search(p, k, result, cxt, coro_id, entry != nullptr)) {
+      if (entry) { // cache stale, from root
+        index_cache->invalidate(entry);
+        entry = nullptr;
+        p = root;
+        goto next;
+      }
+      std::cout << "SEARCH WARNING insert batch" << std::endl;
+      p = get_root_ptr(cxt, coro_id);
+      sleep(1);
+      goto next;
+    }
+    entry = nullptr;
+
+    if (!result.is_leaf) {
+      assert(result.level != 0);
+      if (result.slibing != GlobalAddress::Null()) {
+        p = result.slibing;
+        goto next;
+      }
+
+      p = result.next_level;
+      if (result.level != 1) {
+        goto next;
+      }
+    }
+
+    done += leaf_page_store_batch(p, keys, values, idx, n - done, root, 0, cxt,
+                                  coro_id);
+  }
+}
+
 bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
   assert(dsm->is_register());
 
@@ -414,24 +802,29 @@ bool Tree::search(const Key &k, Value &v, CoroContext *cxt, int coro_id) {
   const CacheEntry *entry = nullptr;
   if (enable_cache) {
     GlobalAddress cache_addr;
-    entry = index_cache->search_from_cache(k, &cache_addr,
-                                           dsm->getMyThreadID() == 0);
+    entry = index_cache->search_from_cache(k, &cache_addr);
     if (entry) { // cache hit
       cache_hit[dsm->getMyThreadID()][0]++;
-      from_cache = true;
       p = cache_addr;
+      if (leaf_cache && leaf_cache_search(p, k, v, cxt, coro_id)) {
+        return true;
+      }
 
     } else {
       cache_miss[dsm->getMyThreadID()][0]++;
+      p = traversal_start(k, root, &entry);
     }
+    from_cache = entry != nullptr;
   }
 
 next:
   if (!page_search(p, k, result, cxt, coro_id, from_cache)) {
     if (from_cache) { // cache stale
       index_cache->invalidate(entry);
-      cache_hit[dsm->getMyThreadID()][0]--;
-      cache_miss[dsm->getMyThreadID()][0]++;
+      if (result.is_leaf) { // from a level-1 page
+        cache_hit[dsm->getMyThreadID()][0]--;
+        cache_miss[dsm->getMyThreadID()][0]++;
+      }
       from_cache = false;
 
       p = root;
@@ -441,7 +834,12 @@ next:
     }
     goto next;
   }
+  from_cache = false;
   if (result.is_leaf) {
+    if (leaf_cache && (result.val != kValueNull ||
+                       result.slibing == GlobalAddress::Null())) {
+      leaf_cache->access(p, result.leaf); // the leaf of k
+    }
     if (result.val != kValueNull) { // find
       v = result.val;
       return true;
@@ -458,87 +856,404 @@ next:
   }
 }
 
-uint64_t Tree::range_query(const Key &from, const Key &to, Value *value_buffer,
-                           CoroContext *cxt, int coro_id) {
+// serve k from the cached copy of |leaf|: as is within the lease, else
+// after reading back its record and the page version (~20B instead of the
+// whole leaf). false if k is not in the copy or the copy is stale
+bool Tree::leaf_cache_search(GlobalAddress leaf, const Key &k, Value &v,
+                             CoroContext *cxt, int coro_id) {
+  auto &stat = leaf_cache->stat(dsm->getMyThreadID());
+
+  Value cached;
+  uint8_t version;
+  bool fresh;
+  int index = leaf_cache->lookup(leaf, k, &cached, &version, &fresh);
+  if (index == -1) {
+    stat.miss++;
+    return false;
+  }
+  if (fresh) {
+    stat.hit++;
+    v = cached;
+    return true;
+  }
 
-  const int kParaFetch = 32;
-  thread_local std::vector<InternalPage *> result;
-  thread_local std::vector<GlobalAddress> leaves;
-
-  result.clear();
-  leaves.clear();
-  index_cache->search_range_from_cache(from, to, result);
-  
-  // FIXME: here, we assume all innernal nodes are cached in compute node
-  if (result.empty()) {
-    return 0;
+  // records only move when the leaf splits, which rewrites the whole leaf
+  // in increasing address order with a new front version. READs of a post
+  // are executed in order, so the version read after the record is
+  // unchanged only if the record was read before the split began
+  auto buffer = (dsm->get_rbuf(coro_id)).get_page_buffer();
+  auto r = (LeafEntry *)buffer;
+  auto front_version = (uint8_t *)(buffer + sizeof(LeafEntry));
+
+  RdmaOpRegion rs[2];
+  rs[0].source = (uint64_t)r;
+  rs[0].dest = GADD(leaf, STRUCT_OFFSET(LeafPage, records) +
+                              index * sizeof(LeafEntry));
+  rs[0].size = sizeof(LeafEntry);
+  rs[0].is_on_chip = false;
+
+  rs[1].source = (uint64_t)front_version;
+  rs[1].dest = GADD(leaf, STRUCT_OFFSET(LeafPage, front_version));
+  rs[1].size = sizeof(uint8_t);
+  rs[1].is_on_chip = false;
+
+  dsm->read_batches_sync(rs, 2, cxt);
+
+  if (*front_version != version || r->f_version != r->r_version ||
+      r->key != k || r->value == kValueNull) { // stale or being written
+    leaf_cache->invalidate(leaf);
+    stat.miss++;
+    return false;
   }
 
-  uint64_t counter = 0;
-  for (auto page : result) {
-    auto cnt = page->hdr.last_index + 1;
-    auto addr = page->hdr.leftmost_ptr;
-
-    // [from, to]
-    // [lowest, page->records[0].key);
-    bool no_fetch = from > page->records[0].key || to < page->hdr.lowest;
-    if (!no_fetch) {
-      leaves.push_back(addr);
-    }
-    for (int i = 1; i < cnt; ++i) {
-      no_fetch = from > page->records[i].key || to < page->records[i - 1].key;
-      if (!no_fetch) {
-        leaves.push_back(page->records[i - 1].ptr);
+  if (r->value != cached || leaf_cache->has_lease()) {
+    leaf_cache->refresh(leaf, index, k, r->value);
+  }
+  stat.validate++;
+  v = r->value;
+  return true;
+}
+
+// leaves of all keys are taken from the index cache and read together
+// (overlapped across memory nodes), so a batch costs about one round trip;
+// keys missing from the cache or with a stale leaf fall back to search().
+// return the number of keys found
+int Tree::search_batch(const Key *keys, Value *values, bool *found, int n,
+                       CoroContext *cxt, int coro_id) {
+  assert(dsm->is_register());
+
+  const int kParaFetch = 32;
+  RdmaOpRegion rs[kParaFetch];
+  GlobalAddress leaves[kParaFetch];
+  char *range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+
+  std::vector<int> slot(n, -1); // leaf slot of each key, -1: from root
+  std::vector<const CacheEntry *> entries(n, nullptr);
+
+  int res = 0;
+  int i = 0;
+  while (i < n) {
+    int begin = i;
+    int leaf_cnt = 0;
+
+    for (; i < n; ++i) {
+      if (!enable_cache) {
+        continue;
+      }
+
+      GlobalAddress cache_addr;
+      entries[i] = index_cache->search_from_cache(keys[i], &cache_addr);
+      if (!entries[i]) {
+        cache_miss[dsm->getMyThreadID()][0]++;
+        continue;
+      }
+      cache_hit[dsm->getMyThreadID()][0]++;
+
+      int s = 0;
+      while (s < leaf_cnt && leaves[s] != cache_addr) {
+        s++;
+      }
+      if (s == leaf_cnt) {
+        if (leaf_cnt == kParaFetch) { // buffer is full
+          cache_hit[dsm->getMyThreadID()][0]--;
+          break;
+        }
+        leaves[leaf_cnt] = cache_addr;
+        rs[leaf_cnt].source = (uint64_t)range_buffer + s * kLeafPageSize;
+        rs[leaf_cnt].dest = cache_addr;
+        rs[leaf_cnt].size = kLeafPageSize;
+        rs[leaf_cnt].is_on_chip = false;
+        leaf_cnt++;
       }
+      slot[i] = s;
     }
 
-    no_fetch = from > page->hdr.highest || to < page->records[cnt - 1].key;
-    if (!no_fetch) {
-      leaves.push_back(page->records[cnt - 1].ptr);
+    if (leaf_cnt > 0) {
+      dsm->read_batches_sync(rs, leaf_cnt, cxt);
     }
-  }
 
-  int cq_cnt = 0;
-  char *range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
-  for (size_t i = 0; i < leaves.size(); ++i) {
-    if (i > 0 && i % kParaFetch == 0) {
-      dsm->poll_rdma_cq(kParaFetch);
-      cq_cnt -= kParaFetch;
-      for (int k = 0; k < kParaFetch; ++k) {
-        auto page = (LeafPage *)(range_buffer + k * kLeafPageSize);
-        for (int i = 0; i < kLeafCardinality; ++i) {
-          auto &r = page->records[i];
-          if (r.value != kValueNull && r.f_version == r.r_version) {
-            if (r.key >= from && r.key <= to) {
-              value_buffer[counter++] = r.value;
-            }
-          }
+    for (int k = begin; k < i; ++k) {
+      if (slot[k] == -1) {
+        continue;
+      }
+
+      auto page = (LeafPage *)(range_buffer + slot[k] * kLeafPageSize);
+      if (!page->check_consistent() || keys[k] < page->hdr.lowest ||
+          keys[k] >= page->hdr.highest) {
+        if (page->check_consistent()) { // cache stale
+          index_cache->invalidate(entries[k]);
+          cache_hit[dsm->getMyThreadID()][0]--;
+          cache_miss[dsm->getMyThreadID()][0]++;
         }
+        slot[k] = -1;
+        continue;
+      }
+
+      SearchResult result;
+      memset(&result, 0, sizeof(result));
+      leaf_page_search(page, keys[k], result);
+
+      found[k] = result.val != kValueNull;
+      if (found[k]) {
+        values[k] = result.val;
+        res++;
       }
     }
-    dsm->read(range_buffer + kLeafPageSize * (i % kParaFetch), leaves[i],
-              kLeafPageSize, true);
-    cq_cnt++;
-  }
-
-  if (cq_cnt != 0) {
-    dsm->poll_rdma_cq(cq_cnt);
-    for (int k = 0; k < cq_cnt; ++k) {
-      auto page = (LeafPage *)(range_buffer + k * kLeafPageSize);
-      for (int i = 0; i < kLeafCardinality; ++i) {
-        auto &r = page->records[i];
-        if (r.value != kValueNull && r.f_version == r.r_version) {
-          if (r.key >= from && r.key <= to) {
-            value_buffer[counter++] = r.value;
-          }
+
+    // from root, after the leaves are consumed (search uses the same buffer)
+    for (int k = begin; k < i; ++k) {
+      if (slot[k] == -1) {
+        found[k] = search(keys[k], values[k], cxt, coro_id);
+        if (found[k]) {
+          res++;
         }
       }
     }
   }
 
+  return res;
+}
+
+uint64_t Tree::range_query(const Key &from, const Key &to, Value *value_buffer,
+                           CoroContext *cxt, int coro_id) {
+  uint64_t counter = 0;
+
+  ScanState st(from, to);
+  while (!st.done) {
+    scan_level1_page(
+        st, [&](const Key &, const Value &v) { value_buffer[counter++] = v; },
+        cxt, coro_id);
+  }
+
   return counter;
 }
 
+ScanCursor::ScanCursor(Tree *tree, const Key &from, const Key &to,
+                       CoroContext *cxt, int coro_id)
+    : tree(tree), cxt(cxt), coro_id(coro_id), st(from, to), pos(0),
+      resume(from) {}
+
+int ScanCursor::next(Key *keys, Value *values, int max_cnt) {
+  int cnt = 0;
+  while (cnt < max_cnt) {
+    if (pos == pending.size()) {
+      if (st.done) {
+        break;
+      }
+
+      pending.clear();
+      pos = 0;
+      tree->scan_level1_page(
+          st,
+          [&](const Key &k, const Value &v) {
+            pending.push_back(std::make_pair(k, v));
+          },
+          cxt, coro_id);
+      // a batch covers a contiguous key range, sorting it is enough
+      std::sort(pending.begin(), pending.end());
+      continue;
+    }
+
+    keys[cnt] = pending[pos].first;
+    values[cnt] = pending[pos].second;
+    pos++;
+    cnt++;
+  }
+
+  if (cnt > 0) {
+    resume = keys[cnt - 1] + 1;
+  }
+
+  return cnt;
+}
+
+// one step of a scan: the leaves under the level-1 page covering st.next
+// that overlap the range are read in one batch, together with the next
+// level-1 page (prefetch). level-1 pages come from the prefetch, the index
+// cache, or the root; leaves split after the parent was read are reached
+// via sibling_ptr. entries are emitted unordered, st.next then advances to
+// the highest key of the page
+template <class F>
+void Tree::scan_level1_page(ScanState &st, F &&emit, CoroContext *cxt,
+                            int coro_id) {
+
+  const int kMaxLeaves = kInternalCardinality + 1;
+
+  char *range_buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  char *parent_buffer = range_buffer + kMaxLeaves * kLeafPageSize;
+  char *prefetch_buffer = parent_buffer + kInternalPageSize;
+  char *sibling_buffer = prefetch_buffer + kInternalPageSize;
+  assert(sibling_buffer + kLeafPageSize <=
+         dsm->get_rdma_buffer() + (coro_id + 1) * define::kPerCoroRdmaBuf);
+
+  RdmaOpRegion rs[kMaxLeaves + 1];
+  GlobalAddress leaves[kMaxLeaves];
+  Key bounds[kMaxLeaves]; // leaves[i] covers keys up to bounds[i]
+
+  if (st.next > st.to) {
+    st.done = true;
+    return;
+  }
+
+  // emit entries in [next, min(highest, to)]
+  auto scan_leaf = [&](LeafPage *leaf) {
+    for (int i = 0; i < kLeafCardinality; ++i) {
+      auto &r = leaf->records[i];
+      if (r.value != kValueNull && r.f_version == r.r_version &&
+          r.key >= st.next && r.key < leaf->hdr.highest && r.key <= st.to) {
+        emit(r.key, r.value);
+      }
+    }
+    st.done = leaf->hdr.highest > st.to || leaf->hdr.highest == kKeyMax;
+    st.next = leaf->hdr.highest;
+  };
+
+  auto parent = (InternalPage *)parent_buffer;
+  int leaf_cnt = 0;
+
+  bool has_parent = false;
+  if (st.prefetched) {
+    auto page = (InternalPage *)st.next_parent;
+    if (page->check_consistent() && page->hdr.lowest == st.next) {
+      memcpy(parent_buffer, st.next_parent, kInternalPageSize);
+      has_parent = true;
+    }
+    st.prefetched = false;
+  }
+
+  if (!has_parent && enable_cache) {
+    Epoch::Guard guard(index_cache->epoch()); // the page is not freed
+    GlobalAddress leaf_addr;
+    auto entry = index_cache->search_from_cache(st.next, &leaf_addr);
+    InternalPage *page = entry ? entry->ptr : nullptr;
+    if (page) {
+      memcpy(parent_buffer, page, kInternalPageSize);
+      has_parent =
+          parent->hdr.lowest <= st.next && st.next < parent->hdr.highest;
+    }
+  }
+
+  if (!has_parent) {
+    GlobalAddress leaf_addr;
+    has_parent =
+        read_level1_page(st.next, parent_buffer, leaf_addr, cxt, coro_id);
+    if (!has_parent) { // the root is a leaf
+      leaves[0] = leaf_addr;
+      bounds[0] = kKeyMax;
+      leaf_cnt = 1;
+    }
+  }
+
+  if (has_parent) {
+    auto cnt = parent->hdr.last_index + 1;
+    for (int i = 0; i <= cnt; ++i) {
+      Key lowest = i == 0 ? parent->hdr.lowest : parent->keys[i - 1];
+      Key highest = i == cnt ? parent->hdr.highest : parent->keys[i];
+      if (highest <= st.next) {
+        continue;
+      }
+      if (lowest > st.to) {
+        break;
+      }
+      leaves[leaf_cnt] =
+          i == 0 ? parent->hdr.leftmost_ptr : parent->ptrs[i - 1];
+      bounds[leaf_cnt] = highest;
+      leaf_cnt++;
+    }
+  }
+
+  for (int i = 0; i < leaf_cnt; ++i) {
+    rs[i].source = (uint64_t)range_buffer + i * kLeafPageSize;
+    rs[i].dest = leaves[i];
+    rs[i].size = kLeafPageSize;
+    rs[i].is_on_chip = false;
+  }
+  int read_cnt = leaf_cnt;
+  bool prefetch = has_parent && parent->hdr.highest <= st.to &&
+                  parent->hdr.sibling_ptr != GlobalAddress::Null();
+  if (prefetch) {
+    rs[read_cnt].source = (uint64_t)prefetch_buffer;
+    rs[read_cnt].dest = parent->hdr.sibling_ptr;
+    rs[read_cnt].size = kInternalPageSize;
+    rs[read_cnt].is_on_chip = false;
+    read_cnt++;
+  }
+  dsm->read_batches_sync(rs, read_cnt, cxt);
+
+  if (prefetch) {
+    memcpy(st.next_parent, prefetch_buffer, kInternalPageSize);
+    st.prefetched = true;
+  }
+
+  for (int i = 0; i < leaf_cnt && !st.done; ++i) {
+    auto leaf = (LeafPage *)(range_buffer + i * kLeafPageSize);
+    GlobalAddress addr = leaves[i];
+    while (!leaf->check_consistent()) { // torn read
+      leaf = (LeafPage *)sibling_buffer;
+      dsm->read_sync(sibling_buffer, addr, kLeafPageSize, cxt);
+    }
+    assert(leaf->hdr.lowest <= st.next);
+    scan_leaf(leaf);
+
+    // split after the parent was read
+    while (!st.done && st.next < bounds[i]) {
+      addr = leaf->hdr.sibling_ptr;
+      assert(addr != GlobalAddress::Null());
+      leaf = (LeafPage *)sibling_buffer;
+      do {
+        dsm->read_sync(sibling_buffer, addr, kLeafPageSize, cxt);
+      } while (!leaf->check_consistent());
+      scan_leaf(leaf);
+    }
+  }
+}
+
+// read the level-1 page covering |k| into |buffer| from the root.
+// if the root is a leaf, return false and its address in |leaf_addr|
+bool Tree::read_level1_page(const Key &k, char *buffer,
+                            GlobalAddress &leaf_addr, CoroContext *cxt,
+                            int coro_id) {
+  auto header = (Header *)(buffer + (STRUCT_OFFSET(InternalPage, hdr)));
+  auto page = (InternalPage *)buffer;
+
+  auto root = get_root_ptr(cxt, coro_id);
+  const CacheEntry *entry;
+  GlobalAddress p = traversal_start(k, root, &entry);
+  while (true) {
+    dsm->read_sync(buffer, p, kInternalPageSize, cxt);
+
+    if (header->leftmost_ptr == GlobalAddress::Null()) {
+      leaf_addr = p;
+      return false;
+    }
+    if (!page->check_consistent()) {
+      continue;
+    }
+    if (entry && (k < page->hdr.lowest || k >= page->hdr.highest)) {
+      index_cache->invalidate(entry); // cache stale, from root
+      entry = nullptr;
+      p = root;
+      continue;
+    }
+    entry = nullptr;
+    if (k >= page->hdr.highest) {
+      p = page->hdr.sibling_ptr;
+      continue;
+    }
+
+    if (enable_cache) {
+      index_cache->add_to_cache(page);
+    }
+    if (page->hdr.level == 1) {
+      return true;
+    }
+
+    SearchResult result;
+    internal_page_search(page, k, result);
+    p = result.next_level;
+  }
+}
+
 void Tree::del(const Key &k, CoroContext *cxt, int coro_id) {
   assert(dsm->is_register());
 
@@ -546,8 +1261,7 @@ void Tree::del(const Key &k, CoroContext *cxt, int coro_id) {
 
   if (enable_cache) {
     GlobalAddress cache_addr;
-    auto entry = index_cache->search_from_cache(k, &cache_addr,
-                                                dsm->getMyThreadID() == 0);
+    auto entry = index_cache->search_from_cache(k, &cache_addr);
     if (entry) { // cache hit
       if (leaf_page_del(cache_addr, k, 0, cxt, coro_id, true)) {
 
@@ -563,16 +1277,24 @@ void Tree::del(const Key &k, CoroContext *cxt, int coro_id) {
   auto root = get_root_ptr(cxt, coro_id);
   SearchResult result;
 
-  GlobalAddress p = root;
+  const CacheEntry *entry;
+  GlobalAddress p = traversal_start(k, root, &entry);
 
 next:
 
-  if (!page_search(p, k, result, cxt, coro_id)) {
+  if (!page_search(p, k, result, cxt, coro_id, entry != nullptr)) {
+    if (entry) { // cache stale, from root
+      index_cache->invalidate(entry);
+      entry = nullptr;
+      p = root;
+      goto next;
+    }
     std::cout << "SEARCH WARNING del" << std::endl;
     p = get_root_ptr(cxt, coro_id);
     sleep(1);
     goto next;
   }
+  entry = nullptr;
 
   if (!result.is_leaf) {
     assert(result.level != 0);
@@ -616,6 +1338,7 @@ re_read:
     if (!page->check_consistent()) {
       goto re_read;
     }
+    result.leaf = page;
 
     if (from_cache &&
         (k < page->hdr.lowest || k >= page->hdr.highest)) { // cache is stale
@@ -634,14 +1357,18 @@ re_read:
     leaf_page_search(page, k, result);
   } else {
     assert(result.level != 0);
-    assert(!from_cache);
     auto page = (InternalPage *)page_buffer;
 
     if (!page->check_consistent()) {
       goto re_read;
     }
 
-    if (result.level == 1 && enable_cache) {
+    if (from_cache &&
+        (k < page->hdr.lowest || k >= page->hdr.highest)) { // cache is stale
+      return false;
+    }
+
+    if (enable_cache) {
       index_cache->add_to_cache(page);
     }
 
@@ -668,30 +1395,18 @@ void Tree::internal_page_search(InternalPage *page, const Key &k,
   assert(k >= page->hdr.lowest);
   assert(k < page->hdr.highest);
 
-  auto cnt = page->hdr.last_index + 1;
   // page->debug();
-  if (k < page->records[0].key) {
-    result.next_level = page->hdr.leftmost_ptr;
-    return;
-  }
-
-  for (int i = 1; i < cnt; ++i) {
-    if (k < page->records[i].key) {
-      result.next_level = page->records[i - 1].ptr;
-      return;
-    }
-  }
-  result.next_level = page->records[cnt - 1].ptr;
+  result.next_level = page->child(k);
 }
 
 void Tree::leaf_page_search(LeafPage *page, const Key &k,
                             SearchResult &result) {
 
-  for (int i = 0; i < kLeafCardinality; ++i) {
+  int i = page->find(k);
+  if (i != -1) {
     auto &r = page->records[i];
-    if (r.key == k && r.value != kValueNull && r.f_version == r.r_version) {
+    if (r.f_version == r.r_version) {
       result.val = r.value;
-      break;
     }
   }
 }
@@ -738,13 +1453,13 @@ void Tree::internal_page_store(GlobalAddress page_addr, const Key &k,
   bool is_update = false;
   uint16_t insert_index = 0;
   for (int i = cnt - 1; i >= 0; --i) {
-    if (page->records[i].key == k) { // find and update
-      page->records[i].ptr = v;
+    if (page->keys[i] == k) { // find and update
+      page->ptrs[i] = v;
       // assert(false);
       is_update = true;
       break;
     }
-    if (page->records[i].key < k) {
+    if (page->keys[i] < k) {
       insert_index = i + 1;
       break;
     }
@@ -754,11 +1469,11 @@ void Tree::internal_page_store(GlobalAddress page_addr, const Key &k,
 
   if (!is_update) { // insert and shift
     for (int i = cnt; i > insert_index; --i) {
-      page->records[i].key = page->records[i - 1].key;
-      page->records[i].ptr = page->records[i - 1].ptr;
+      page->keys[i] = page->keys[i - 1];
+      page->ptrs[i] = page->ptrs[i - 1];
     }
-    page->records[insert_index].key = k;
-    page->records[insert_index].ptr = v;
+    page->keys[insert_index] = k;
+    page->ptrs[insert_index] = v;
 
     page->hdr.last_index++;
   }
@@ -768,7 +1483,8 @@ void Tree::internal_page_store(GlobalAddress page_addr, const Key &k,
   Key split_key;
   GlobalAddress sibling_addr;
   if (need_split) { // need split
-    sibling_addr = dsm->alloc(kInternalPageSize);
+    sibling_addr = dsm->alloc(
+        kInternalPageSize, placement_hint(page_addr, level, coro_id), cxt);
     auto sibling_buf = rbuf.get_sibling_buffer();
 
     auto sibling = new (sibling_buf) InternalPage(page->hdr.level);
@@ -777,20 +1493,20 @@ void Tree::internal_page_store(GlobalAddress page_addr, const Key &k,
     //    (int)(page->hdr.level) << std::endl;
 
     int m = cnt / 2;
-    split_key = page->records[m].key;
+    split_key = page->keys[m];
     assert(split_key > page->hdr.lowest);
     assert(split_key < page->hdr.highest);
     for (int i = m + 1; i < cnt; ++i) { // move
-      sibling->records[i - m - 1].key = page->records[i].key;
-      sibling->records[i - m - 1].ptr = page->records[i].ptr;
+      sibling->keys[i - m - 1] = page->keys[i];
+      sibling->ptrs[i - m - 1] = page->ptrs[i];
     }
     page->hdr.last_index -= (cnt - m);
     sibling->hdr.last_index += (cnt - m - 1);
 
-    sibling->hdr.leftmost_ptr = page->records[m].ptr;
-    sibling->hdr.lowest = page->records[m].key;
+    sibling->hdr.leftmost_ptr = page->ptrs[m];
+    sibling->hdr.lowest = page->keys[m];
     sibling->hdr.highest = page->hdr.highest;
-    page->hdr.highest = page->records[m].key;
+    page->hdr.highest = page->keys[m];
 
     // link
     sibling->hdr.sibling_ptr = page->hdr.sibling_ptr;
@@ -820,8 +1536,8 @@ void Tree::internal_page_store(GlobalAddress page_addr, const Key &k,
   if (up_level != GlobalAddress::Null()) {
     internal_page_store(up_level, split_key, sibling_addr, root, level + 1, cxt,
                         coro_id);
-  } else {
-    assert(false);
+  } else { // the path started below the root (from the index cache)
+    insert_internal(split_key, sibling_addr, cxt, coro_id, level + 1);
   }
 }
 
@@ -850,6 +1566,9 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
 
   lock_and_read_page(page_buffer, page_addr, kLeafPageSize, cas_buffer,
                      lock_addr, tag, cxt, coro_id);
+  if (leaf_cache) { // read our own writes within the lease
+    leaf_cache->invalidate(page_addr);
+  }
 
   auto page = (LeafPage *)page_buffer;
 
@@ -873,28 +1592,23 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
   assert(k >= page->hdr.lowest);
 
   int cnt = 0;
-  int empty_index = -1;
-  char *update_addr = nullptr;
-  for (int i = 0; i < kLeafCardinality; ++i) {
-
-    auto &r = page->records[i];
-    if (r.value != kValueNull) {
-      cnt++;
-      if (r.key == k) {
-        r.value = v;
-        r.f_version++;
-        r.r_version = r.f_version;
-        update_addr = (char *)&r;
-        break;
+  int update_index = page->find(k);
+  if (update_index != -1) {
+    auto &r = page->records[update_index];
+    r.value = v;
+    r.f_version++;
+    r.r_version = r.f_version;
+  } else { // insert new item
+    int empty_index = -1;
+    for (int i = 0; i < kLeafCardinality; ++i) {
+      if (page->records[i].value != kValueNull) {
+        cnt++;
+      } else if (empty_index == -1) {
+        empty_index = i;
       }
-    } else if (empty_index == -1) {
-      empty_index = i;
     }
-  }
-
-  assert(cnt != kLeafCardinality);
 
-  if (update_addr == nullptr) { // insert new item
+    assert(cnt != kLeafCardinality);
     if (empty_index == -1) {
       printf("%d cnt\n", cnt);
       assert(false);
@@ -905,30 +1619,160 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
     r.value = v;
     r.f_version++;
     r.r_version = r.f_version;
+    page->update_fp(empty_index);
 
-    update_addr = (char *)&r;
+    update_index = empty_index;
 
     cnt++;
   }
 
   bool need_split = cnt == kLeafCardinality;
   if (!need_split) {
-    assert(update_addr);
-    write_page_and_unlock(
-        update_addr, GADD(page_addr, (update_addr - (char *)page)),
-        sizeof(LeafEntry), cas_buffer, lock_addr, tag, cxt, coro_id, false);
+    write_leaf_and_unlock(page, update_index, update_index, page_addr,
+                          cas_buffer, lock_addr, tag, cxt, coro_id);
 
     return true;
-  } else {
-    std::sort(
-        page->records, page->records + kLeafCardinality,
-        [](const LeafEntry &a, const LeafEntry &b) { return a.key < b.key; });
   }
 
+  leaf_page_split(page, page_addr, cnt, root, level, cas_buffer, lock_addr,
+                  tag, cxt, coro_id, from_cache);
+
+  return true;
+}
+
+// store keys[idx[0]], keys[idx[1]], ... (sorted) under one lock of the leaf,
+// until a key falls out of the leaf or the leaf has to split.
+// return how many keys are stored, 0 if the cached leaf is stale
+int Tree::leaf_page_store_batch(GlobalAddress page_addr, const Key *keys,
+                                const Value *values, const int *idx, int cnt,
+                                GlobalAddress root, int level,
+                                CoroContext *cxt, int coro_id,
+                                bool from_cache) {
+
+  uint64_t lock_index =
+      CityHash64((char *)&page_addr, sizeof(page_addr)) % define::kNumOfLock;
+
+  GlobalAddress lock_addr;
+
+#ifdef CONFIG_ENABLE_EMBEDDING_LOCK
+  lock_addr = page_addr;
+#else
+  lock_addr.nodeID = page_addr.nodeID;
+  lock_addr.offset = lock_index * sizeof(uint64_t);
+#endif
+
+  auto &rbuf = dsm->get_rbuf(coro_id);
+  uint64_t *cas_buffer = rbuf.get_cas_buffer();
+  auto page_buffer = rbuf.get_page_buffer();
+
+  auto tag = dsm->getThreadTag();
+  assert(tag != 0);
+
+  lock_and_read_page(page_buffer, page_addr, kLeafPageSize, cas_buffer,
+                     lock_addr, tag, cxt, coro_id);
+  if (leaf_cache) { // read our own writes within the lease
+    leaf_cache->invalidate(page_addr);
+  }
+
+  auto page = (LeafPage *)page_buffer;
+
+  assert(page->hdr.level == level);
+  assert(page->check_consistent());
+
+  const Key &first = keys[idx[0]];
+  if (from_cache && (first < page->hdr.lowest ||
+                     first >= page->hdr.highest)) { // cache is stale
+    this->unlock_addr(lock_addr, tag, cas_buffer, cxt, coro_id, true);
+    return 0;
+  }
+
+  if (first >= page->hdr.highest) {
+
+    this->unlock_addr(lock_addr, tag, cas_buffer, cxt, coro_id, true);
+    assert(page->hdr.sibling_ptr != GlobalAddress::Null());
+    return this->leaf_page_store_batch(page->hdr.sibling_ptr, keys, values,
+                                       idx, cnt, root, level, cxt, coro_id);
+  }
+  assert(first >= page->hdr.lowest);
+
+  int page_cnt = 0;
+  for (int i = 0; i < kLeafCardinality; ++i) {
+    if (page->records[i].value != kValueNull) {
+      page_cnt++;
+    }
+  }
+  assert(page_cnt != kLeafCardinality);
+
+  int empty_index = 0;
+  int lo = kLeafCardinality; // range of modified entries
+  int hi = -1;
+  bool need_split = false;
+
+  int stored = 0;
+  while (stored < cnt && !need_split) {
+    const Key &k = keys[idx[stored]];
+    if (k >= page->hdr.highest) {
+      break;
+    }
+
+    int pos = page->find(k);
+    if (pos == -1) { // insert new item
+      while (page->records[empty_index].value != kValueNull) {
+        empty_index++;
+      }
+      assert(empty_index < kLeafCardinality);
+
+      pos = empty_index;
+      page_cnt++;
+      need_split = page_cnt == kLeafCardinality;
+    }
+
+    auto &r = page->records[pos];
+    r.key = k;
+    r.value = values[idx[stored]];
+    r.f_version++;
+    r.r_version = r.f_version;
+    page->update_fp(pos);
+
+    lo = std::min(lo, pos);
+    hi = std::max(hi, pos);
+    stored++;
+  }
+  assert(stored > 0);
+
+  if (need_split) {
+    leaf_page_split(page, page_addr, page_cnt, root, level, cas_buffer,
+                    lock_addr, tag, cxt, coro_id, from_cache);
+    return stored;
+  }
+
+  // one WRITE covering all modified entries; entries in between are
+  // written back as read, which is safe since we hold the lock
+  write_leaf_and_unlock(page, lo, hi, page_addr, cas_buffer, lock_addr, tag,
+                        cxt, coro_id);
+
+  return stored;
+}
+
+// |page| is locked and full (|cnt| == kLeafCardinality): move the upper half
+// to a new sibling, write both back, unlock, and insert the split key into
+// the upper level
+void Tree::leaf_page_split(LeafPage *page, GlobalAddress page_addr, int cnt,
+                           GlobalAddress root, int level, uint64_t *cas_buffer,
+                           GlobalAddress lock_addr, uint64_t tag,
+                           CoroContext *cxt, int coro_id, bool from_cache) {
+
+  auto &rbuf = dsm->get_rbuf(coro_id);
+
+  std::sort(
+      page->records, page->records + kLeafCardinality,
+      [](const LeafEntry &a, const LeafEntry &b) { return a.key < b.key; });
+
   Key split_key;
   GlobalAddress sibling_addr;
-  if (need_split) { // need split
-    sibling_addr = dsm->alloc(kLeafPageSize);
+  {
+    sibling_addr = dsm->alloc(
+        kLeafPageSize, placement_hint(page_addr, level, coro_id), cxt);
     auto sibling_buf = rbuf.get_sibling_buffer();
 
     auto sibling = new (sibling_buf) LeafPage(page->hdr.level);
@@ -950,6 +1794,11 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
     page->hdr.last_index -= (cnt - m);
     sibling->hdr.last_index += (cnt - m);
 
+    for (int i = 0; i < kLeafCardinality; ++i) {
+      page->update_fp(i);
+      sibling->update_fp(i);
+    }
+
     sibling->hdr.lowest = split_key;
     sibling->hdr.highest = page->hdr.highest;
     page->hdr.highest = split_key;
@@ -964,16 +1813,13 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
 
   page->set_consistent();
 
-  write_page_and_unlock(page_buffer, page_addr, kLeafPageSize, cas_buffer,
-                        lock_addr, tag, cxt, coro_id, need_split);
-
-  if (!need_split)
-    return true;
+  write_page_and_unlock((char *)page, page_addr, kLeafPageSize, cas_buffer,
+                        lock_addr, tag, cxt, coro_id, true);
 
   if (root == page_addr) { // update root
     if (update_new_root(page_addr, split_key, sibling_addr, level + 1, root,
                         cxt, coro_id)) {
-      return true;
+      return;
     }
   }
 
@@ -986,8 +1832,6 @@ bool Tree::leaf_page_store(GlobalAddress page_addr, const Key &k,
     assert(from_cache);
     insert_internal(split_key, sibling_addr, cxt, coro_id, level + 1);
   }
-
-  return true;
 }
 
 bool Tree::leaf_page_del(GlobalAddress page_addr, const Key &k, int level,
@@ -1013,6 +1857,9 @@ bool Tree::leaf_page_del(GlobalAddress page_addr, const Key &k, int level,
 
   lock_and_read_page(page_buffer, page_addr, kLeafPageSize, cas_buffer,
                      lock_addr, tag, cxt, coro_id);
+  if (leaf_cache) { // read our own writes within the lease
+    leaf_cache->invalidate(page_addr);
+  }
 
   auto page = (LeafPage *)page_buffer;
 
@@ -1034,22 +1881,15 @@ bool Tree::leaf_page_del(GlobalAddress page_addr, const Key &k, int level,
 
   assert(k >= page->hdr.lowest);
 
-  char *update_addr = nullptr;
-  for (int i = 0; i < kLeafCardinality; ++i) {
-    auto &r = page->records[i];
-    if (r.key == k && r.value != kValueNull) {
-      r.value = kValueNull;
-      r.f_version++;
-      r.r_version = r.f_version;
-      update_addr = (char *)&r;
-      break;
-    }
-  }
+  int update_index = page->find(k);
+  if (update_index != -1) {
+    auto &r = page->records[update_index];
+    r.value = kValueNull;
+    r.f_version++;
+    r.r_version = r.f_version;
 
-  if (update_addr) {
-    write_page_and_unlock(
-        update_addr, GADD(page_addr, (update_addr - (char *)page)),
-        sizeof(LeafEntry), cas_buffer, lock_addr, tag, cxt, coro_id, false);
+    write_leaf_and_unlock(page, update_index, update_index, page_addr,
+                          cas_buffer, lock_addr, tag, cxt, coro_id);
   } else {
     this->unlock_addr(lock_addr, tag, cas_buffer, cxt, coro_id, false);
   }
@@ -1091,11 +1931,7 @@ void Tree::coro_worker(CoroYield &yield, RequstGen *gen, int coro_id) {
     } else {
       this->insert(r.k, r.v, &ctx, coro_id);
     }
-    auto us_10 = coro_timer.end() / 100;
-    if (us_10 >= LATENCY_WINDOWS) {
-      us_10 = LATENCY_WINDOWS - 1;
-    }
-    latency[thread_id][us_10]++;
+    latency[thread_id].record(coro_timer.end());
   }
 }
 
@@ -1121,6 +1957,148 @@ void Tree::coro_master(CoroYield &yield, int coro_cnt) {
   }
 }
 
+// shared by the coroutines of a warm-up, they run on one thread
+struct WarmUp {
+  std::queue<std::pair<GlobalAddress, int>> todo; // internal pages, level
+  int busy;           // workers waiting for a read
+  int done;           // workers finished
+  uint64_t cached;    // pages added
+  uint64_t bytes;     // read so far
+  double bytes_per_ns; // 0: no limit
+  uint64_t start;     // ns
+
+  // under the bandwidth limit, a worker may read
+  bool may_read() const {
+    return bytes_per_ns == 0 ||
+           bytes <= bytes_per_ns * (Timer::get_time_ns() - start);
+  }
+};
+
+uint64_t Tree::warm_up_index_cache(int coro_cnt, double mb_per_sec) {
+  using namespace std::placeholders;
+
+  assert(coro_cnt <= define::kMaxCoro);
+  if (!enable_cache) {
+    return 0;
+  }
+
+  auto root = get_root_ptr(nullptr, 0);
+  auto page = (InternalPage *)(dsm->get_rbuf(0)).get_page_buffer();
+  dsm->read_sync((char *)page, root, kInternalPageSize);
+  if (page->hdr.level == 0) { // no internal pages
+    return 0;
+  }
+
+  WarmUp w;
+  w.todo.push(std::make_pair(root, (int)page->hdr.level));
+  w.busy = 0;
+  w.done = 0;
+  w.cached = 0;
+  w.bytes = 0;
+  w.bytes_per_ns = mb_per_sec * define::MB / 1000000000.0;
+  w.start = Timer::get_time_ns();
+
+  for (int i = 0; i < coro_cnt; ++i) {
+    worker[i] =
+        CoroCall(std::bind(&Tree::warm_up_worker, this, _1, &w, i));
+  }
+  master = CoroCall(std::bind(&Tree::warm_up_master, this, _1, &w, coro_cnt));
+  master();
+
+  return w.cached;
+}
+
+// breadth first: a worker takes a batch of pages from the queue, caches
+// them and queues their children. a worker waits in hot_wait_queue before
+// each batch, the master lets it go under the bandwidth limit
+void Tree::warm_up_worker(CoroYield &yield, WarmUp *w, int coro_id) {
+  CoroContext ctx;
+  ctx.coro_id = coro_id;
+  ctx.master = &master;
+  ctx.yield = &yield;
+
+  const int kBatch = 16;
+  char *buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  RdmaOpRegion rs[kBatch];
+
+  while (true) {
+    hot_wait_queue.push(coro_id);
+    yield(master);
+
+    if (w->todo.empty()) {
+      if (w->busy == 0) {
+        break;
+      }
+      continue; // more pages may come from the others
+    }
+
+    int cnt = 0;
+    while (cnt < kBatch && !w->todo.empty()) {
+      auto t = w->todo.front();
+      w->todo.pop();
+      if (t.second < IndexCache::kMaxLevel &&
+          index_cache->occupancy(t.second) >= index_cache->budget(t.second)) {
+        continue; // the level is full
+      }
+      rs[cnt].source = (uint64_t)buffer + cnt * kInternalPageSize;
+      rs[cnt].dest = t.first;
+      rs[cnt].size = kInternalPageSize;
+      rs[cnt].is_on_chip = false;
+      cnt++;
+    }
+    if (cnt == 0) {
+      continue;
+    }
+
+    w->busy++;
+    w->bytes += cnt * kInternalPageSize;
+    dsm->read_batches_sync(rs, cnt, &ctx);
+    w->busy--;
+
+    for (int i = 0; i < cnt; ++i) {
+      auto page = (InternalPage *)(buffer + i * kInternalPageSize);
+      if (!page->check_consistent()) {
+        continue; // torn, cached on a miss later
+      }
+      if (index_cache->add_to_cache(page)) {
+        w->cached++;
+      }
+      int level = page->hdr.level;
+      if (level >= 2) {
+        w->todo.push(std::make_pair(page->hdr.leftmost_ptr, level - 1));
+        for (int k = 0; k <= page->hdr.last_index; ++k) {
+          w->todo.push(std::make_pair(page->ptrs[k], level - 1));
+        }
+      }
+    }
+  }
+
+  w->done++;
+  while (true) { // the master returns once all are done
+    yield(master);
+  }
+}
+
+void Tree::warm_up_master(CoroYield &yield, WarmUp *w, int coro_cnt) {
+  for (int i = 0; i < coro_cnt; ++i) {
+    yield(worker[i]);
+  }
+
+  while (w->done < coro_cnt) {
+    uint64_t next_coro_id;
+
+    if (dsm->poll_rdma_cq_once(next_coro_id)) {
+      yield(worker[next_coro_id]);
+    }
+
+    if (!hot_wait_queue.empty() && w->may_read()) {
+      next_coro_id = hot_wait_queue.front();
+      hot_wait_queue.pop();
+      yield(worker[next_coro_id]);
+    }
+  }
+}
+
 // Local Locks
 inline bool Tree::acquire_local_lock(GlobalAddress lock_addr, CoroContext *cxt,
                                      int coro_id) {
@@ -1172,14 +2150,109 @@ inline void Tree::releases_local_lock(GlobalAddress lock_addr) {
   node.ticket_lock.fetch_add((1ull << 32));
 }
 
+bool Tree::save_index_cache(const char *path) {
+  return index_cache->snapshot(path);
+}
+
+int64_t Tree::load_index_cache(const char *path) {
+  return index_cache->load(path);
+}
+
+// level by level from the top, so that the address of a cached page is
+// the child pointer of its parent, which was just revalidated
+uint64_t Tree::revalidate_index_cache(CoroContext *cxt, int coro_id) {
+  const int kBatch = 32;
+  char *buffer = (dsm->get_rbuf(coro_id)).get_range_buffer();
+  assert(buffer + kBatch * kInternalPageSize <=
+         dsm->get_rdma_buffer() + (coro_id + 1) * define::kPerCoroRdmaBuf);
+
+  RdmaOpRegion rs[kBatch];
+  const CacheEntry *entries[kBatch];
+  uint64_t stale = 0;
+
+  auto root = get_root_ptr(cxt, coro_id);
+  dsm->read_sync(buffer, root, kInternalPageSize, cxt);
+  int root_level = ((InternalPage *)buffer)->hdr.level;
+
+  // the pages in |buffer| against the cached copies
+  auto check = [&](int cnt) {
+    dsm->read_batches_sync(rs, cnt, cxt);
+
+    Epoch::Guard guard(index_cache->epoch());
+    for (int i = 0; i < cnt; ++i) {
+      int k = (rs[i].source - (uint64_t)buffer) / kInternalPageSize;
+      auto page = (InternalPage *)rs[i].source;
+      auto copy = entries[k]->ptr;
+      if (copy == nullptr || !page->check_consistent()) {
+        continue; // evicted, or torn: validated on use
+      }
+      // all but index_cache_freq
+      int offset = STRUCT_OFFSET(InternalPage, front_version);
+      if (memcmp((char *)copy + offset, (char *)page + offset,
+                 kInternalPageSize - offset) != 0) {
+        index_cache->invalidate(entries[k]);
+        index_cache->add_to_cache(page);
+        stale++;
+      }
+    }
+  };
+
+  // a page is reached from its parent, the root or a cached page one level
+  // up; levels from kMaxLevel on are not cached
+  int top = root_level < IndexCache::kMaxLevel ? root_level
+                                               : IndexCache::kMaxLevel - 2;
+  std::vector<const CacheEntry *> cached;
+  for (int l = top; l >= 1; --l) {
+    index_cache->cached_entries(l, cached);
+
+    int cnt = 0;
+    for (auto e : cached) {
+      GlobalAddress addr = root;
+      if (l != root_level) {
+        Epoch::Guard guard(index_cache->epoch());
+        auto parent = index_cache->find_entry(e->from, l + 1);
+        auto page = parent ? parent->ptr : nullptr;
+        if (page == nullptr || parent->from > e->from) {
+          continue; // parent not cached
+        }
+        addr = page->child(e->from);
+      }
+
+      rs[cnt].source = (uint64_t)buffer + cnt * kInternalPageSize;
+      rs[cnt].dest = addr;
+      rs[cnt].size = kInternalPageSize;
+      rs[cnt].is_on_chip = false;
+      entries[cnt] = e;
+      if (++cnt == kBatch) {
+        check(cnt);
+        cnt = 0;
+      }
+    }
+    if (cnt > 0) {
+      check(cnt);
+    }
+  }
+
+  return stale;
+}
+
 void Tree::index_cache_statistics() {
   index_cache->statistics();
   index_cache->bench();
 }
 
+void Tree::leaf_cache_statistics() {
+  if (leaf_cache) {
+    leaf_cache->statistics();
+  }
+}
+
 void Tree::clear_statistics() {
   for (int i = 0; i < MAX_APP_THREAD; ++i) {
     cache_hit[i][0] = 0;
     cache_miss[i][0] = 0;
   }
+  if (leaf_cache) {
+    leaf_cache->clear_stat();
+  }
 }
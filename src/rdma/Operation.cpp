@@ -379,6 +379,39 @@ bool rdmaWriteBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
   return true;
 }
 
+// k READs with one doorbell, only the last one is signaled
+bool rdmaReadBatch(ibv_qp *qp, RdmaOpRegion *ror, int k, bool isSignaled,
+                   uint64_t wrID) {
+
+  assert(k <= kReadBatchMax);
+
+  struct ibv_sge sg[kReadBatchMax];
+  struct ibv_send_wr wr[kReadBatchMax];
+  struct ibv_send_wr *wrBad;
+
+  for (int i = 0; i < k; ++i) {
+    fillSgeWr(sg[i], wr[i], ror[i].source, ror[i].size, ror[i].lkey);
+
+    wr[i].next = (i == k - 1) ? NULL : &wr[i + 1];
+
+    wr[i].opcode = IBV_WR_RDMA_READ;
+
+    if (i == k - 1 && isSignaled) {
+      wr[i].send_flags = IBV_SEND_SIGNALED;
+    }
+
+    wr[i].wr.rdma.remote_addr = ror[i].dest;
+    wr[i].wr.rdma.rkey = ror[i].remoteRKey;
+    wr[i].wr_id = wrID;
+  }
+
+  if (ibv_post_send(qp, &wr[0], &wrBad) != 0) {
+    Debug::notifyError("Send with RDMA_READ(batch) failed.");
+    return false;
+  }
+  return true;
+}
+
 bool rdmaCasRead(ibv_qp *qp, const RdmaOpRegion &cas_ror,
                  const RdmaOpRegion &read_ror, uint64_t compare, uint64_t swap,
                  bool isSignaled, uint64_t wrID) {
@@ -0,0 +1,139 @@
+#include "DSM.h"
+#include "Timer.h"
+#include "Tree.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 启动阶段很多客户端线程同时批量插入时 MALLOC RPC 的延迟：
+// 每个线程往自己的 key 区间批量插入，叶子分裂不断分配新页；
+// 在每个内存节点上的第一次分配、以及 chunk 预取没赶上时，alloc 要等
+// MALLOC 回复。输出等待的次数、延迟分位数和插入吞吐，
+// 对比不同的 directory 线程数（dirs）和放置策略。
+// Usage: ./alloc_bench [key=value ...]
+//   nodes=2 threads=8 dirs=1 keys=200000
+//   placement=rr (rr / interleave / least / parent)
+//   emu=1 (0: RDMA，每台机器都运行一份)
+
+int kNodeCount = 2;
+int kThreadCount = 8;
+int kDirCount = 1;
+uint64_t kKeyPerThread = 200000;
+Placement kPlacement = Placement::ROUND_ROBIN;
+bool kEmulated = true;
+
+const int kBatch = 64;
+
+DSM *dsm;
+Tree *tree;
+std::atomic<bool> start(false);
+std::atomic<int> ready(0);
+uint64_t elapsed_ns[MAX_APP_THREAD];
+
+void thread_run(int id) {
+  dsm->registerThread();
+
+  // 各线程（包括其他计算节点的）的 key 区间不重叠
+  uint64_t base = (uint64_t(dsm->getMyNodeID()) * kThreadCount + id + 1) << 32;
+  Key keys[kBatch];
+  Value values[kBatch];
+
+  ready++;
+  while (!start.load()) {
+  }
+
+  Timer timer;
+  timer.begin();
+  for (uint64_t i = 0; i < kKeyPerThread; i += kBatch) {
+    int n = std::min<uint64_t>(kBatch, kKeyPerThread - i);
+    for (int k = 0; k < n; ++k) {
+      keys[k] = base + i + k;
+      values[k] = i + k + 1;
+    }
+    tree->insert_batch(keys, values, n);
+  }
+  elapsed_ns[id] = timer.end();
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+      printf("Usage: ./alloc_bench [key=value ...]\n");
+      return -1;
+    }
+    auto key = arg.substr(0, eq);
+    std::string val = arg.c_str() + eq + 1;
+    if (key == "nodes") {
+      kNodeCount = atoi(val.c_str());
+    } else if (key == "threads") {
+      kThreadCount = atoi(val.c_str());
+    } else if (key == "dirs") {
+      kDirCount = atoi(val.c_str());
+    } else if (key == "keys") {
+      kKeyPerThread = atoll(val.c_str());
+    } else if (key == "placement") {
+      kPlacement = val == "interleave" ? Placement::INTERLEAVE
+                   : val == "least"    ? Placement::LEAST_USED
+                   : val == "parent"   ? Placement::NEAR_PARENT
+                                       : Placement::ROUND_ROBIN;
+    } else if (key == "emu") {
+      kEmulated = atoi(val.c_str()) != 0;
+    } else {
+      printf("unknown option %s\n", key.c_str());
+      return -1;
+    }
+  }
+  assert(kThreadCount < MAX_APP_THREAD);
+
+  DSMConfig config;
+  config.machineNR = kNodeCount;
+  config.dirNR = kDirCount;
+  config.placement = kPlacement;
+  if (kEmulated) {
+    config.transport = TransportType::EMULATED;
+  }
+  dsm = DSM::getInstance(config);
+
+  dsm->registerThread();
+  tree = new Tree(dsm);
+  dsm->clear_metrics();
+
+  std::vector<std::thread> th;
+  for (int i = 0; i < kThreadCount; ++i) {
+    th.emplace_back(thread_run, i);
+  }
+  while (ready.load() != kThreadCount) {
+  }
+  dsm->barrier("alloc_bench");
+  start = true;
+  for (auto &t : th) {
+    t.join();
+  }
+
+  uint64_t max_ns = 0;
+  for (int i = 0; i < kThreadCount; ++i) {
+    max_ns = std::max(max_ns, elapsed_ns[i]);
+  }
+  auto metrics = dsm->get_metrics();
+  auto latency = dsm->get_malloc_latency();
+
+  printf("nodes %d, threads %d, dirs %d, %lu keys per thread\n", kNodeCount,
+         kThreadCount, kDirCount, kKeyPerThread);
+  printf("insert %.3f Mops, malloc rpc %lu, waited %lu\n",
+         kKeyPerThread * kThreadCount * 1000.0 / std::max<uint64_t>(1, max_ns),
+         metrics.count(DSMMetrics::kMallocRpc), latency.count());
+  printf("malloc wait us: p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+         latency.percentile(50) / 1000.0, latency.percentile(90) / 1000.0,
+         latency.percentile(99) / 1000.0, latency.max_value() / 1000.0);
+  for (int i = 0; i < kNodeCount; ++i) {
+    uint64_t used, total;
+    dsm->chunk_usage(i, &used, &total);
+    printf("node %d: %lu / %lu chunks\n", i, used, total);
+  }
+
+  return 0;
+}
@@ -1,7 +1,9 @@
+#include "Histogram.h"
 #include "Timer.h"
 #include "Tree.h"
 #include "zipf.h"
 
+#include <algorithm>
 #include <city.h>
 #include <stdlib.h>
 #include <thread>
@@ -18,24 +20,33 @@ const int kCoroCnt = 3;
 int kReadRatio;
 int kThreadCount;
 int kNodeCount;
+bool kEmulated = false; // all memory nodes in this process, no RNIC
+bool kBulkLoad = false; // node 0 loads the warmup keys bottom-up
 uint64_t kKeySpace = 64 * define::MB;
 double kWarmRatio = 0.8;
 double zipfan = 0;
+bool kLeafCache = false; // 计算节点缓存热点叶子页
+uint64_t kLeafLease = 0; // ns，0 表示每次命中都校验
+bool kWarmCache = false;   // 正式测试前用协程遍历内部页预热索引缓存
+double kWarmCacheMBps = 0; // 预热读带宽上限，0 表示不限
+// 新页放在哪个内存节点：ROUND_ROBIN（按 chunk 轮流）/ INTERLEAVE（按页轮流）/
+// LEAST_USED / NEAR_PARENT（分裂的兄弟页和父页同节点）
+Placement kPlacement = Placement::ROUND_ROBIN;
+int kDirCount = 1; // 每个内存节点处理 RPC 的 directory 线程数
 
 //////////////////// workload parameters /////////////////////
 
 
 extern uint64_t cache_miss[MAX_APP_THREAD][8];
 extern uint64_t cache_hit[MAX_APP_THREAD][8];
-extern uint64_t read_cnt;
-extern uint64_t read_bytes;
+extern bool enable_leaf_cache;
+extern uint64_t leaf_cache_lease_ns;
 
 
 std::thread th[MAX_APP_THREAD];
 uint64_t tp[MAX_APP_THREAD][8];
 
-extern uint64_t latency[MAX_APP_THREAD][LATENCY_WINDOWS];
-uint64_t latency_th_all[LATENCY_WINDOWS];
+extern LatencyHistogram latency[MAX_APP_THREAD];
 
 Tree *tree;
 DSM *dsm;
@@ -99,7 +110,9 @@ void thread_run(int id) {
   dsm->registerThread();
 
   // 所有线程数 = 一个节点的线程总数 * 集群节点数
-  uint64_t all_thread = kThreadCount * dsm->getClusterSize();
+  // (emulated: only one compute node)
+  uint64_t all_thread =
+      kThreadCount * (dsm->is_emulated() ? 1 : dsm->getClusterSize());
   // 当前线程id，多节点多线程二维扁平到一维。
   uint64_t my_id = kThreadCount * dsm->getMyNodeID() + id;
 
@@ -112,7 +125,7 @@ void thread_run(int id) {
 
   // end_warm_key，热身数据的数量
   uint64_t end_warm_key = kWarmRatio * kKeySpace;
-  for (uint64_t i = 1; i < end_warm_key; ++i) {
+  for (uint64_t i = 1; i < end_warm_key && !kBulkLoad; ++i) {
       // 线程划分方法，分线程热身数据insert。
     if (i % all_thread == my_id) {
       tree->insert(to_key(i), i * 2);
@@ -135,6 +148,13 @@ void thread_run(int id) {
     uint64_t ns = bench_timer.end();
     printf("warmup time %lds\n", ns / 1000 / 1000 / 1000);
 
+    if (kWarmCache) {
+      bench_timer.begin();
+      auto pages = tree->warm_up_index_cache(kCoroCnt, kWarmCacheMBps);
+      printf("index cache warm up: %lu pages in %ldms\n", pages,
+             bench_timer.end() / 1000 / 1000);
+    }
+
     // 索引缓存统计输出
     tree->index_cache_statistics();
     tree->clear_statistics();
@@ -177,12 +197,8 @@ void thread_run(int id) {
       tree->insert(key, v);
     }
 
-    // 纳秒数/100，相当于微秒数*10
-    auto us_10 = timer.end() / 100;
-    if (us_10 >= LATENCY_WINDOWS) {
-      us_10 = LATENCY_WINDOWS - 1;
-    }
-    latency[id][us_10]++;
+    // 纳秒精度，记录到本线程的直方图
+    latency[id].record(timer.end());
 
     tp[id][0]++;
   }
@@ -191,61 +207,63 @@ void thread_run(int id) {
 }
 
 void parse_args(int argc, char *argv[]) {
-  if (argc != 4) {
-    printf("Usage: ./benchmark kNodeCount kReadRatio kThreadCount\n");
+  if (argc != 4 && argc != 5) {
+    printf("Usage: ./benchmark kNodeCount kReadRatio kThreadCount [emu]\n");
     exit(-1);
   }
 
   kNodeCount = atoi(argv[1]);
   kReadRatio = atoi(argv[2]);
   kThreadCount = atoi(argv[3]);
+  kEmulated = argc == 5 && strcmp(argv[4], "emu") == 0;
 
-  printf("kNodeCount %d, kReadRatio %d, kThreadCount %d\n", kNodeCount,
-         kReadRatio, kThreadCount);
+  printf("kNodeCount %d, kReadRatio %d, kThreadCount %d%s\n", kNodeCount,
+         kReadRatio, kThreadCount, kEmulated ? " (emulated)" : "");
 }
 
+// 合并各线程的直方图（从开始运行起累计），打印分位数延迟，单位 us
 void cal_latency() {
-  uint64_t all_lat = 0;
-  for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-    latency_th_all[i] = 0;
-    for (int k = 0; k < MAX_APP_THREAD; ++k) {
-      latency_th_all[i] += latency[k][i];
-    }
-    all_lat += latency_th_all[i];
+  LatencyHistogram all;
+  for (int k = 0; k < MAX_APP_THREAD; ++k) {
+    all.merge(latency[k]);
   }
 
-  uint64_t th50 = all_lat / 2;
-  uint64_t th90 = all_lat * 9 / 10;
-  uint64_t th95 = all_lat * 95 / 100;
-  uint64_t th99 = all_lat * 99 / 100;
-  uint64_t th999 = all_lat * 999 / 1000;
-
-  uint64_t cum = 0;
-  for (int i = 0; i < LATENCY_WINDOWS; ++i) {
-    cum += latency_th_all[i];
+  const double kPercentiles[] = {50, 90, 95, 99, 99.9, 99.99};
+  const char *kNames[] = {"p50", "p90", "p95", "p99", "p999", "p9999"};
+  for (int i = 0; i < 6; ++i) {
+    printf("%s %.3f\t", kNames[i], all.percentile(kPercentiles[i]) / 1000.0);
+  }
+  printf("max %.3f\n", all.max_value() / 1000.0);
+}
 
-    if (cum >= th50) {
-      printf("p50 %f\t", i / 10.0);
-      th50 = -1;
-    }
-    if (cum >= th90) {
-      printf("p90 %f\t", i / 10.0);
-      th90 = -1;
-    }
-    if (cum >= th95) {
-      printf("p95 %f\t", i / 10.0);
-      th95 = -1;
-    }
-    if (cum >= th99) {
-      printf("p99 %f\t", i / 10.0);
-      th99 = -1;
+// 热身数据按 key 排序后自底向上批量构建索引，代替逐个 insert
+void bulk_load() {
+  uint64_t end_warm_key = kWarmRatio * kKeySpace;
+  std::vector<std::pair<Key, Value>> kvs;
+  kvs.reserve(end_warm_key);
+  for (uint64_t i = 1; i < end_warm_key; ++i) {
+    kvs.push_back(std::make_pair(to_key(i), i * 2));
+  }
+  std::stable_sort(
+      kvs.begin(), kvs.end(),
+      [](const std::pair<Key, Value> &a, const std::pair<Key, Value> &b) {
+        return a.first < b.first;
+      });
+
+  // 重复的 key 保留最后一次的值，与逐个 insert 的结果一致
+  size_t cur = 0;
+  tree->bulk_load([&](Key &k, Value &v) {
+    if (cur == kvs.size()) {
+      return false;
     }
-    if (cum >= th999) {
-      printf("p999 %f\n", i / 10.0);
-      th999 = -1;
-      return;
+    while (cur + 1 < kvs.size() && kvs[cur + 1].first == kvs[cur].first) {
+      cur++;
     }
-  }
+    k = kvs[cur].first;
+    v = kvs[cur].second;
+    cur++;
+    return true;
+  });
 }
 
 // 测试的时候，每个节点都需要执行这个，因为需要把当前节点注册到DSM
@@ -258,22 +276,43 @@ int main(int argc, char *argv[]) {
   // 设置配置节点数，并创建DSM对象。
   DSMConfig config;
   config.machineNR = kNodeCount;
+  if (kEmulated) {
+    config.transport = TransportType::EMULATED;
+  }
+  config.placement = kPlacement;
+  config.dirNR = kDirCount;
   dsm = DSM::getInstance(config);
 
   // 注册当前节点线程
   dsm->registerThread();
   // 创建分布式系统 树索引
+  enable_leaf_cache = kLeafCache;
+  leaf_cache_lease_ns = kLeafLease;
   tree = new Tree(dsm);
 
   // 插入数据，只有ID为0的节点才执行插入。这样多个节点只有一个节点写入数据
   if (dsm->getMyNodeID() == 0) {
-    for (uint64_t i = 1; i <= 1024000; ++i) {
+    if (kBulkLoad) {
+      bench_timer.begin();
+      bulk_load();
+      printf("bulk load time %ldms\n", bench_timer.end() / 1000 / 1000);
+    } else {
+      for (uint64_t i = 1; i <= 1024000; ++i) {
         // to_key 通过 hash 生成 key
-      tree->insert(to_key(i), i * 2);
+        tree->insert(to_key(i), i * 2);
+      }
     }
   }
-  printf("total read cnt: %llu\n", read_cnt);
-  printf("total read bytes: %llu\n", read_bytes);
+  dsm->get_metrics().print();
+  auto malloc_latency = dsm->get_malloc_latency();
+  printf("malloc wait %lu times, p99 %.1fus\n", malloc_latency.count(),
+         malloc_latency.percentile(99) / 1000.0);
+  for (int i = 0; i < kNodeCount; ++i) { // 各内存节点的 chunk 用量
+    uint64_t used, total;
+    dsm->chunk_usage(i, &used, &total);
+    printf("node %d: %lu / %lu chunks\n", i, used, total);
+  }
+  dsm->clear_metrics();
 
   // 同步操作，所有线程将在此等待，直到所有节点都执行到这。
   // 应该是主要等待数据插入完成。这里使用 memcache 中的key进行同步。
@@ -294,6 +333,9 @@ int main(int argc, char *argv[]) {
   timespec s, e;
   // 用于存储前一次的吞吐量数据
   uint64_t pre_tp = 0;
+  // 前一次的 RDMA 操作数与字节数
+  uint64_t pre_verbs = 0;
+  uint64_t pre_verb_bytes = 0;
 
   int count = 0;
 
@@ -317,6 +359,13 @@ int main(int argc, char *argv[]) {
     uint64_t cap = all_tp - pre_tp;
     pre_tp = all_tp;
 
+    // 本轮每个请求平均的 RDMA 操作数与字节数（各线程快照汇总，不打断测试线程）
+    auto metrics = dsm->get_metrics();
+    uint64_t verbs = metrics.total_count() - pre_verbs;
+    uint64_t verb_bytes = metrics.total_bytes() - pre_verb_bytes;
+    pre_verbs = metrics.total_count();
+    pre_verb_bytes = metrics.total_bytes();
+
     // 计算查询所有线程查询缓存的总次数（hit+miss），以及hit命中次数，后面计算命中率。
     uint64_t all = 0;
     uint64_t hit = 0;
@@ -339,11 +388,14 @@ int main(int argc, char *argv[]) {
     uint64_t cluster_tp = dsm->sum((uint64_t)(per_node_tp * 1000));
 
     printf("%d, throughput %.4f\n", dsm->getMyNodeID(), per_node_tp);
+    printf("%d, rdma verbs per op %.2f, bytes per op %.1f\n",
+           dsm->getMyNodeID(), verbs * 1.0 / cap, verb_bytes * 1.0 / cap);
 
     // 0号节点 打印 集群吞吐量 和 缓存命中率
     if (dsm->getMyNodeID() == 0) {
       printf("cluster throughput %.3f\n", cluster_tp / 1000.0);
       printf("cache hit rate: %lf\n", hit * 1.0 / all);
+      tree->leaf_cache_statistics();
     }
   }
 
@@ -0,0 +1,229 @@
+#include "Histogram.h"
+#include "IndexCache.h"
+#include "Timer.h"
+#include "zipf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <city.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// index cache 的多线程微基准，不依赖 RDMA，任何 Linux 机器都能跑：
+// 1. 填充：多线程并发 add_to_cache 工作集中的 level-1 页（合成的 InternalPage）
+// 2. 混合负载：每个线程按 zipf 选页查找，未命中时像 Tree 一样 add_to_cache；
+//    churn% 的操作模拟分裂：invalidate 后重新加入。
+//    (100 - hit)% 的查找落在工作集之外的冷区间，必然未命中并挤占缓存。
+// 输出吞吐、命中率、查找延迟分位数、淘汰数和内存占用。
+// Usage: ./index_cache_bench [key=value ...]
+//   threads=4 cache_mb=64 pages=200000 hit=100 theta=0.99 churn=1
+//   seconds=3 backend=both (skiplist / btree / both)
+
+int kThreadCount = 4;
+int kCacheMB = 64;
+uint64_t kPageCount = 200000; // 工作集页数
+int kHitRatio = 100;          // 查找落在工作集内的百分比
+double kTheta = 0.99;
+int kChurnRatio = 1; // invalidate + 重新加入的百分比
+int kSeconds = 3;
+std::string kBackend = "both";
+
+const Key kWidth = 1000;       // 每页覆盖的 key 数
+const int kColdFactor = 16;    // 冷区间页数 = kColdFactor * kPageCount
+
+// 页 id 对应的合成 level-1 页，两个孩子指针都记录 id，用于检查查找结果
+void make_page(InternalPage *page, uint64_t id) {
+  GlobalAddress child;
+  child.val = id + 1;
+  new (page) InternalPage(child, id * kWidth + kWidth / 2, child, 1);
+  page->set_range(id * kWidth, (id + 1) * kWidth);
+}
+
+// 进程当前驻留内存，KB
+uint64_t rss_kb() {
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[256];
+  uint64_t kb = 0;
+  while (f && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "VmRSS: %lu kB", &kb) == 1) {
+      break;
+    }
+  }
+  if (f) {
+    fclose(f);
+  }
+  return kb;
+}
+
+struct Stat {
+  uint64_t op;
+  uint64_t hit;
+  uint64_t miss;
+  uint64_t fill;
+  uint64_t churn;
+  uint64_t wrong;
+  LatencyHistogram lookup;
+
+  Stat() : op(0), hit(0), miss(0), fill(0), churn(0), wrong(0) {}
+};
+
+void run(IndexCache::Backend backend, const char *name) {
+  uint64_t rss_before = rss_kb();
+  // 不释放：跳表节点不能删除
+  auto cache = new IndexCache(kCacheMB, backend);
+
+  // 填充：插入顺序随机，每个线程插入一段
+  std::vector<uint64_t> order(kPageCount);
+  for (uint64_t i = 0; i < kPageCount; ++i) {
+    order[i] = i;
+  }
+  std::random_shuffle(order.begin(), order.end());
+
+  std::vector<std::thread> th(kThreadCount);
+  Timer timer;
+  timer.begin();
+  for (int t = 0; t < kThreadCount; ++t) {
+    th[t] = std::thread([&, t]() {
+      // add_to_cache 拷贝 kInternalPageSize 字节，比 sizeof(InternalPage) 大
+      alignas(64) char buf[kInternalPageSize];
+      auto page = (InternalPage *)buf;
+      for (uint64_t i = t; i < kPageCount; i += kThreadCount) {
+        make_page(page, order[i]);
+        cache->add_to_cache(page);
+      }
+    });
+  }
+  for (auto &t : th) {
+    t.join();
+  }
+  auto fill_ns = timer.end(kPageCount) * kThreadCount;
+
+  // 混合负载，跑 kSeconds 秒
+  std::vector<Stat> stats(kThreadCount);
+  std::atomic<bool> stop(false);
+  for (int t = 0; t < kThreadCount; ++t) {
+    th[t] = std::thread([&, t]() {
+      auto &s = stats[t];
+
+      struct zipf_gen_state state;
+      mehcached_zipf_init(&state, kPageCount, kTheta,
+                          (rdtsc() & 0x0000ffffffffffffull) ^ t);
+      unsigned int seed = t + 1;
+      alignas(64) char buf[kInternalPageSize];
+      auto page = (InternalPage *)buf;
+      Timer op_timer;
+
+      while (!stop.load(std::memory_order_relaxed)) {
+        uint64_t id;
+        if ((int)(rand_r(&seed) % 100) < kHitRatio) {
+          // 热页分散到整个工作集
+          uint64_t r = mehcached_zipf_next(&state);
+          id = CityHash64((char *)&r, sizeof(r)) % kPageCount;
+        } else {
+          id = kPageCount + rand_r(&seed) % (kColdFactor * kPageCount);
+        }
+        Key k = id * kWidth + rand_r(&seed) % kWidth;
+        s.op++;
+
+        GlobalAddress addr;
+        op_timer.begin();
+        auto entry = cache->search_from_cache(k, &addr);
+        s.lookup.record(op_timer.end());
+
+        if (entry == nullptr) { // 未命中，像 Tree 一样读到页后加入缓存
+          s.miss++;
+          make_page(page, id);
+          s.fill += cache->add_to_cache(page);
+          continue;
+        }
+
+        s.hit++;
+        s.wrong += addr.val != id + 1;
+        if ((int)(rand_r(&seed) % 100) < kChurnRatio) { // 模拟分裂
+          cache->invalidate(entry);
+          make_page(page, id);
+          cache->add_to_cache(page);
+          s.churn++;
+        }
+      }
+    });
+  }
+  sleep(kSeconds);
+  stop = true;
+  for (auto &t : th) {
+    t.join();
+  }
+
+  Stat all;
+  for (auto &s : stats) {
+    all.op += s.op;
+    all.hit += s.hit;
+    all.miss += s.miss;
+    all.fill += s.fill;
+    all.churn += s.churn;
+    all.wrong += s.wrong;
+    all.lookup.merge(s.lookup);
+  }
+
+  printf("%-8s fill %ldns/page, %.2f Mops, hit %.3f, fill %lu, churn %lu, "
+         "evicted %lu%s\n",
+         name, fill_ns, all.op / 1000000.0 / kSeconds,
+         all.hit * 1.0 / std::max<uint64_t>(1, all.op), all.fill, all.churn,
+         cache->evictions(1), all.wrong ? ", WRONG RESULT" : "");
+  printf("         lookup ns: p50 %lu p90 %lu p99 %lu p999 %lu max %lu\n",
+         all.lookup.percentile(50), all.lookup.percentile(90),
+         all.lookup.percentile(99), all.lookup.percentile(99.9),
+         all.lookup.max_value());
+  printf("         memory: %lu MB resident, cached %ld / %ld pages\n",
+         (rss_kb() - rss_before) / 1024, cache->occupancy(1),
+         cache->budget(1));
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto eq = arg.find('=');
+    if (eq == std::string::npos) {
+      printf("Usage: ./index_cache_bench [key=value ...]\n");
+      return -1;
+    }
+    auto key = arg.substr(0, eq);
+    auto val = arg.c_str() + eq + 1;
+    if (key == "threads") {
+      kThreadCount = atoi(val);
+    } else if (key == "cache_mb") {
+      kCacheMB = atoi(val);
+    } else if (key == "pages") {
+      kPageCount = atoll(val);
+    } else if (key == "hit") {
+      kHitRatio = atoi(val);
+    } else if (key == "theta") {
+      kTheta = atof(val);
+    } else if (key == "churn") {
+      kChurnRatio = atoi(val);
+    } else if (key == "seconds") {
+      kSeconds = atoi(val);
+    } else if (key == "backend") {
+      kBackend = val;
+    } else {
+      printf("unknown option %s\n", key.c_str());
+      return -1;
+    }
+  }
+  printf("threads %d, cache %dMB, pages %lu, hit %d%%, theta %.2f, "
+         "churn %d%%, %ds\n",
+         kThreadCount, kCacheMB, kPageCount, kHitRatio, kTheta, kChurnRatio,
+         kSeconds);
+
+  if (kBackend != "btree") {
+    run(IndexCache::kSkipList, "skiplist");
+  }
+  if (kBackend != "skiplist") {
+    run(IndexCache::kBTree, "btree");
+  }
+
+  return 0;
+}
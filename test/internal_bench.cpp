@@ -0,0 +1,110 @@
+#include "Timer.h"
+#include "Tree.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+// 内部页（及 index cache）查找子节点的微基准：对比原来的
+// (key, ptr) 交错数组线性扫描、标量二分，以及 key_rank 运行时选出的 SIMD 实现。
+// 不依赖 RDMA。
+// Usage: ./internal_bench [kPageCount]
+
+struct Entry {
+  Key key;
+  GlobalAddress ptr;
+} __attribute__((packed));
+
+// 原布局
+struct AosPage {
+  GlobalAddress leftmost_ptr;
+  int cnt;
+  Entry records[kInternalCardinality];
+
+  GlobalAddress child(const Key &k) const {
+    if (k < records[0].key) {
+      return leftmost_ptr;
+    }
+    for (int i = 1; i < cnt; ++i) {
+      if (k < records[i].key) {
+        return records[i - 1].ptr;
+      }
+    }
+    return records[cnt - 1].ptr;
+  }
+};
+
+// 当前布局
+struct SoaPage {
+  GlobalAddress leftmost_ptr;
+  int cnt;
+  Key keys[kInternalCardinality];
+  GlobalAddress ptrs[kInternalCardinality];
+
+  template <class Rank> GlobalAddress child(const Key &k, Rank rank) const {
+    int i = rank(keys, cnt, k);
+    return i == 0 ? leftmost_ptr : ptrs[i - 1];
+  }
+};
+
+int kPageCount = 16384; // ~16MB per layout
+const int kLookup = 10000000;
+
+template <class F> uint64_t run(const char *name, F &&child) {
+  unsigned int seed = 3;
+  uint64_t sum = 0;
+
+  Timer timer;
+  timer.begin();
+  for (int i = 0; i < kLookup; ++i) {
+    int page = rand_r(&seed) % kPageCount;
+    Key k = ((uint64_t)rand_r(&seed) << 32) | rand_r(&seed);
+    sum += child(page, k).val;
+  }
+  auto ns = timer.end(kLookup);
+
+  printf("%-8s %2d keys/page: %3ldns per lookup\n", name,
+         kInternalCardinality - 1, ns);
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    kPageCount = atoi(argv[1]);
+  }
+  printf("kPageCount %d\n", kPageCount);
+
+  // 每页放满（与分裂前一致），key 随机，ptr 为下标
+  std::vector<AosPage> aos(kPageCount);
+  std::vector<SoaPage> soa(kPageCount);
+  unsigned int seed = 1;
+  for (int p = 0; p < kPageCount; ++p) {
+    int cnt = kInternalCardinality - 1;
+    std::vector<Key> keys(cnt);
+    for (auto &k : keys) {
+      k = ((uint64_t)rand_r(&seed) << 32) | rand_r(&seed);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    aos[p].cnt = soa[p].cnt = cnt;
+    aos[p].leftmost_ptr.val = soa[p].leftmost_ptr.val = 1;
+    for (int i = 0; i < cnt; ++i) {
+      aos[p].records[i].key = soa[p].keys[i] = keys[i];
+      aos[p].records[i].ptr.val = soa[p].ptrs[i].val = i + 2;
+    }
+  }
+
+  auto a = run("linear", [&](int p, const Key &k) { return aos[p].child(k); });
+  auto b = run("binary", [&](int p, const Key &k) {
+    return soa[p].child(k, key_rank_scalar);
+  });
+  auto c = run("simd", [&](int p, const Key &k) {
+    return soa[p].child(k, key_rank_kernel);
+  });
+  if (a != b || a != c) {
+    printf("result mismatch\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include "Timer.h"
+#include "Tree.h"
+
+#include <stdlib.h>
+#include <vector>
+
+// 叶子页内查找的微基准：对比当前的 packed LeafEntry 线性扫描，
+// 与 CONFIG_ENABLE_LEAF_FP 的指纹数组 + SIMD 过滤布局。
+// 不依赖 RDMA，两种布局都在本进程内构造。
+// Usage: ./leaf_bench [kPageCount] [kHitRatio]
+
+constexpr int kHeaderSize = sizeof(Header) + sizeof(uint8_t) * 2 + 8;
+constexpr int kPackedCnt = (kLeafPageSize - kHeaderSize) / sizeof(LeafEntry);
+constexpr int kFpCnt = (kLeafPageSize - kHeaderSize) / (sizeof(LeafEntry) + 1);
+
+struct PackedLeaf {
+  LeafEntry records[kPackedCnt];
+
+  int find(const Key &k) const {
+    for (int i = 0; i < kPackedCnt; ++i) {
+      if (records[i].key == k && records[i].value != kValueNull) {
+        return i;
+      }
+    }
+    return -1;
+  }
+} __attribute__((packed));
+
+struct FpLeaf {
+  uint8_t fp[kFpCnt];
+  LeafEntry records[kFpCnt];
+
+  int find(const Key &k) const {
+    auto mask = fingerprint_match(fp, kFpCnt, key_fingerprint(k));
+    while (mask) {
+      int i = __builtin_ctzll(mask);
+      if (records[i].key == k && records[i].value != kValueNull) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+    return -1;
+  }
+} __attribute__((packed));
+
+static_assert(sizeof(PackedLeaf) + kHeaderSize <= kLeafPageSize, "size");
+static_assert(sizeof(FpLeaf) + kHeaderSize <= kLeafPageSize, "size");
+
+int kPageCount = 16384; // 16MB per layout, larger than LLC of most CPUs
+int kHitRatio = 50;
+const int kLookup = 10000000;
+
+// 每页填满 90%，key 随机
+template <class Leaf>
+void fill(std::vector<Leaf> &pages, int cnt, unsigned int seed) {
+  for (auto &page : pages) {
+    memset((void *)&page, 0, sizeof(Leaf));
+    for (int i = 0; i < cnt * 9 / 10; ++i) {
+      // even keys are present, odd keys are misses
+      page.records[i].key =
+          (((uint64_t)rand_r(&seed) << 32) | rand_r(&seed)) & ~1ull;
+      page.records[i].value = i + 1;
+    }
+  }
+}
+
+template <class Leaf>
+uint64_t run(const std::vector<Leaf> &pages, int cnt,
+             const std::vector<std::pair<int, Key>> &ops, const char *name) {
+  uint64_t found = 0;
+
+  Timer timer;
+  timer.begin();
+  for (auto &op : ops) {
+    found += pages[op.first].find(op.second) != -1;
+  }
+  auto ns = timer.end(ops.size());
+
+  printf("%-8s %2d records/leaf: %3ldns per lookup, found %lu\n", name, cnt,
+         ns, found);
+  return found;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    kPageCount = atoi(argv[1]);
+  }
+  if (argc > 2) {
+    kHitRatio = atoi(argv[2]);
+  }
+  printf("kPageCount %d, kHitRatio %d\n", kPageCount, kHitRatio);
+
+  std::vector<PackedLeaf> packed(kPageCount);
+  std::vector<FpLeaf> fp(kPageCount);
+  fill(packed, kPackedCnt, 1);
+  fill(fp, kFpCnt, 2);
+  for (auto &page : fp) {
+    for (int i = 0; i < kFpCnt; ++i) {
+      page.fp[i] = key_fingerprint(page.records[i].key);
+    }
+  }
+
+  // 同样的页号/命中序列，命中时取页内随机一条记录的 key
+  unsigned int seed = 3;
+  std::vector<std::pair<int, Key>> packed_ops, fp_ops;
+  packed_ops.reserve(kLookup);
+  fp_ops.reserve(kLookup);
+  for (int i = 0; i < kLookup; ++i) {
+    int page = rand_r(&seed) % kPageCount;
+    bool hit = rand_r(&seed) % 100 < kHitRatio;
+    int slot = rand_r(&seed);
+    Key miss = ((uint64_t)rand_r(&seed) << 32) | rand_r(&seed) | 1;
+
+    Key packed_key = packed[page].records[slot % (kPackedCnt * 9 / 10)].key;
+    Key fp_key = fp[page].records[slot % (kFpCnt * 9 / 10)].key;
+    packed_ops.push_back(std::make_pair(page, hit ? packed_key : miss));
+    fp_ops.push_back(std::make_pair(page, hit ? fp_key : miss));
+  }
+
+  auto a = run(packed, kPackedCnt, packed_ops, "packed");
+  auto b = run(fp, kFpCnt, fp_ops, "fp+simd");
+  if (a != b) {
+    printf("result mismatch\n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -3,12 +3,16 @@
 
 // 测试分布式共享内存（DSM）系统中的 Tree 数据结构。
 // 核心任务包括插入、删除和查询操作，同时验证查询结果。
-int main() {
+int main(int argc, char *argv[]) {
 
   // 设置两个节点配置，并基于配置创建DSM对象。
   // NOTE(chenqiang) 配置两个节点的话，每个节点上都需要创建DSM实例并注册线程。
   DSMConfig config;
   config.machineNR = 2;
+  // ./tree_test emu: 单机模拟两个内存节点，不需要 RDMA 网卡和 memcached
+  if (argc > 1 && strcmp(argv[1], "emu") == 0) {
+    config.transport = TransportType::EMULATED;
+  }
   DSM *dsm = DSM::getInstance(config);
 
   // DSM中注册线程
@@ -67,6 +71,151 @@ int main() {
     std::cout << "search result:  " << res << " v: " << v << std::endl;
   }
 
+  // 保存索引缓存快照，最后用于模拟重启
+  const char *snapshot = "/tmp/tree_test.index_cache";
+  assert(tree->save_index_cache(snapshot));
+
+  // 批量插入：覆盖已有元素并追加新元素（会触发叶子分裂），键乱序给出
+  const int kBatch = 512;
+  const uint64_t kEnd = 1 + kBatch * 40;
+  Key keys[kBatch];
+  Value values[kBatch];
+  for (uint64_t i = 1; i < kEnd; i += kBatch) {
+    for (int j = 0; j < kBatch; ++j) {
+      keys[j] = i + (j * 7) % kBatch; // 同一批内打乱顺序
+      values[j] = keys[j] * 4;
+    }
+    tree->insert_batch(keys, values, kBatch);
+  }
+
+  // 验证批量插入结果
+  for (uint64_t i = 1; i < kEnd; ++i) {
+    auto res = tree->search(i, v);
+    assert(res && v == i * 4);
+  }
+
+  // 批量查询，结果应与逐个查询一致
+  bool found[kBatch];
+  for (uint64_t i = 1; i < kEnd; i += kBatch) {
+    for (int j = 0; j < kBatch; ++j) {
+      keys[j] = i + (j * 7) % kBatch;
+    }
+    auto cnt = tree->search_batch(keys, values, found, kBatch);
+    assert(cnt == kBatch);
+    for (int j = 0; j < kBatch; ++j) {
+      assert(found[j] && values[j] == keys[j] * 4);
+    }
+  }
+
+  // 范围查询 [100, 5000]，不依赖索引缓存：关掉缓存（每个 level-1 页从根
+  // 读取）再查一遍，结果相同
+  extern bool enable_cache;
+  std::vector<Value> range_values(kEnd);
+  for (bool cache : {true, false}) {
+    enable_cache = cache;
+    auto range_cnt = tree->range_query(100, 5000, range_values.data());
+    assert(range_cnt == 5000 - 100 + 1);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < range_cnt; ++i) {
+      sum += range_values[i];
+    }
+    assert(sum == (100 + 5000) * range_cnt / 2 * 4);
+  }
+  enable_cache = true;
+
+  // 游标分页扫描 [100, 5000]：每页最多 128 个有序键值对，
+  // 第一页之后用 resume_key 新建游标继续扫描
+  const int kScanPage = 128;
+  Key scan_keys[kScanPage];
+  Value scan_values[kScanPage];
+  Key expect = 100;
+  ScanCursor first_cursor(tree, 100, 5000);
+  auto n = first_cursor.next(scan_keys, scan_values, kScanPage);
+  assert(n == kScanPage);
+  for (int i = 0; i < n; ++i) {
+    assert(scan_keys[i] == expect && scan_values[i] == expect * 4);
+    expect++;
+  }
+  ScanCursor cursor(tree, first_cursor.resume_key(), 5000);
+  while ((n = cursor.next(scan_keys, scan_values, kScanPage)) > 0) {
+    for (int i = 0; i < n; ++i) {
+      assert(scan_keys[i] == expect && scan_values[i] == expect * 4);
+      expect++;
+    }
+  }
+  assert(cursor.end() && expect == 5000 + 1);
+
+  // 模拟计算节点重启：新的 Tree 加载批量插入前保存的索引缓存快照，
+  // 其中的页已经过期（之后有叶子分裂），重新校验后与远端一致
+  auto warm = new Tree(dsm);
+  assert(warm->load_index_cache(snapshot) > 0);
+  warm->revalidate_index_cache();
+  assert(warm->revalidate_index_cache() == 0);
+  for (uint64_t i = 1; i < kEnd; ++i) {
+    auto res = warm->search(i, v);
+    assert(res && v == i * 4);
+  }
+
+  // 冷启动的 Tree 用协程批量读内部页预热索引缓存，限速 100MB/s
+  auto cold = new Tree(dsm);
+  assert(cold->warm_up_index_cache(3, 100) > 0);
+  for (uint64_t i = 1; i < kEnd; ++i) {
+    auto res = cold->search(i, v);
+    assert(res && v == i * 4);
+  }
+
+  // 树的节点占用了内存节点上的 chunk（空指针 chunk 也算已用）
+  uint64_t total = 0;
+  auto chunks_used = [&]() {
+    uint64_t used = 0;
+    total = 0;
+    for (uint16_t node = 0; node < config.machineNR; ++node) {
+      uint64_t u, t;
+      dsm->chunk_usage(node, &u, &t);
+      assert(u >= config.dirNR && u <= t);
+      used += u;
+      total += t;
+    }
+    return used;
+  };
+  uint64_t used = chunks_used();
+  assert(used > config.machineNR * config.dirNR);
+  printf("chunks used %lu / %lu\n", used, total);
+
+  // 释放的页过了 kReuseDelay 才会被重用。默认按 chunk 轮流放在各内存节点
+  // 上：用完当前 chunk 才换到下一个节点。再分配 machineNR + 1 个 chunk 的页
+  // 然后全部释放，中间完整的 machineNR 个 chunk 全空了，还给内存节点
+  const uint64_t kChunkPages = define::kChunkSize / kLeafPageSize;
+  std::vector<GlobalAddress> freed;
+  std::vector<uint64_t> runs(1, 0); // 连续落在同一节点上的页数
+  for (uint64_t i = 0; i < kChunkPages * (config.machineNR + 1); ++i) {
+    freed.push_back(dsm->alloc(kLeafPageSize));
+    if (i > 0 && freed[i].nodeID != freed[i - 1].nodeID) {
+      assert(freed[i].nodeID == (freed[i - 1].nodeID + 1) % config.machineNR);
+      runs.push_back(0);
+    }
+    runs.back()++;
+  }
+  assert(runs.size() == config.machineNR + 2);
+  for (size_t i = 1; i + 1 < runs.size(); ++i) {
+    assert(runs[i] == kChunkPages);
+  }
+  for (auto addr : freed) {
+    dsm->free(addr, kLeafPageSize);
+  }
+  auto fresh = dsm->alloc(kLeafPageSize);
+  assert(std::find(freed.begin(), freed.end(), fresh) == freed.end());
+  used = chunks_used(); // 包括预取的 chunk
+
+  usleep(LocalAllocator::kReuseDelay / 1000 + 1000);
+  auto reused = dsm->alloc(kLeafPageSize);
+  assert(std::find(freed.begin(), freed.end(), reused) != freed.end());
+  assert(chunks_used() == used - config.machineNR);
+
+  // chunk 提前为下一个节点预取：只有第一次分配等了 MALLOC 回复
+  auto stall = dsm->get_metrics().count(DSMMetrics::kMallocStall);
+  assert(stall == 1);
+
   printf("Hello\n");
 
   while (true)
@@ -19,12 +19,6 @@ uint64_t kKeySpace = 64 * define::MB;
 
 //////////////////// workload parameters /////////////////////
 
-extern uint64_t read_cnt;
-extern uint64_t read_bytes;
-extern uint64_t write_cnt;
-extern uint64_t write_bytes;
-extern uint64_t cas_cnt;
-
 Tree *tree;
 DSM *dsm;
 
@@ -69,11 +63,8 @@ int main(int argc, char *argv[]) {
       tree->insert(to_key(random_num), i * 2);
   }
 
-  printf("total read cnt: %llu\n", read_cnt);
-  printf("total read bytes: %llu\n", read_bytes);
-  printf("total write cnt: %llu\n", write_cnt);
-  printf("total write bytes: %llu\n", write_bytes);
-  printf("total cas cnt: %llu\n", cas_cnt);
+  // 各类 RDMA 操作的次数与字节数（所有线程汇总）
+  dsm->get_metrics().print();
   tree->index_cache_statistics();
 
     while (true) {